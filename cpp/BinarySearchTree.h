@@ -57,6 +57,7 @@ public:
 	virtual bool add(T x);
 	virtual bool remove(T x);
 	T find(T x);
+	void findBatch(T *xs, T *ans, size_t m, size_t g);
 	virtual T findEQ(T x);
 	virtual int size();
 	virtual void clear();
@@ -172,22 +173,74 @@ T BinarySearchTree<Node,T>::findEQ(T x) {
 	return null;
 }
 
+/*
+ * Return the smallest value that is greater than or equal to x.  This does
+ * one comparison per level and, rather than stopping early if it finds x,
+ * always goes to the bottom, so that choosing a child is a conditional
+ * move instead of a branch that random searches mispredict half the time.
+ */
 template<class Node, class T>
 T BinarySearchTree<Node,T>::find(T x) {
 	Node *w = r, *z = nil;
 	while (w != nil) {
-		if (x < w->x) {
-			z = w;
-			w = w->left;
-		} else if (x > w->x) {
-			w = w->right;
-		} else {
-			return w->x;
-		}
+		bool right = w->x < x;
+		z = right ? z : w;
+		Node *child[2] = { w->left, w->right };
+		w = child[right];
 	}
 	return z == nil ? null : z->x;
 }
 
+/*
+ * Do m searches at once, storing the answer for xs[j] in ans[j].  Up to g
+ * searches are in flight.  They take turns doing one step each, and each
+ * step prefetches the node the search visits next, so the g searches'
+ * cache misses overlap.  A search that finishes is replaced by the next.
+ */
+template<class Node, class T>
+void BinarySearchTree<Node,T>::findBatch(T *xs, T *ans, size_t m, size_t g) {
+	const size_t gmax = 64;
+	struct Search {
+		size_t j;  // we're looking for xs[j]
+		Node *w;   // the next node to look at
+		Node *z;   // the answer, if w is nil
+	} s[gmax];
+	if (g < 1) g = 1;
+	if (g > gmax) g = gmax;
+	size_t next = 0, k = 0;
+	while (k < g && next < m) {
+		s[k].j = next++;
+		s[k].w = r;
+		s[k++].z = nil;
+	}
+	while (k > 0) {
+		for (size_t q = 0; q < k; ) {
+			Search &c = s[q];
+			Node *w = c.w;
+			if (w != nil) {
+				// the same step as find()
+				bool right = w->x < xs[c.j];
+				Node *child[2] = { w->left, w->right };
+				c.z = right ? c.z : w;
+				c.w = child[right];
+				if (c.w != nil)
+					__builtin_prefetch(c.w);
+				q++;
+				continue;
+			}
+			ans[c.j] = (c.z == nil) ? null : c.z->x;
+			if (next < m) {
+				c.j = next++;
+				c.w = r;
+				c.z = nil;
+				q++;
+			} else {
+				c = s[--k];
+			}
+		}
+	}
+}
+
 template<class Node, class T>
 BinarySearchTree<Node,T>::~BinarySearchTree() {
 	// nothing to do - BinaryTree destructor does cleanup
@@ -0,0 +1,126 @@
+/**
+ * (c) 2014 Pat Morin, Released under a CC BY 3.0 License:
+ *     https://creativecommons.org/licenses/by/3.0/
+ *
+ * Expiry.h : The times at which the values of a TodoList4 expire
+ *
+ * An ExpiryTable maps each value that expires to its time, and keeps a
+ * priority queue of (time, value) deadlines so that they can be taken in
+ * order of expiry.  Changing a value's time or forgetting it leaves its
+ * old deadline in the queue; pop() skips such stale deadlines.
+ *
+ * A TodoList4 only lets values expire if its Expiry policy is Timed.  With
+ * the default, Untimed, its table is an empty stand-in, nothing has
+ * expired as far as the compiler can tell, and T needn't have a std::hash.
+ */
+#ifndef FASTWS_EXPIRY_H_
+#define FASTWS_EXPIRY_H_
+
+#include <cstddef>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+#include <utility>
+
+namespace todolist {
+
+template<class T, class Time>
+class ExpiryTable {
+protected:
+	struct Deadline {
+		Time t;
+		T x;
+		bool operator<(const Deadline &d) const { return t > d.t; }
+	};
+	typedef std::unordered_map<T,Time> Map;
+	Map times;
+	std::priority_queue<Deadline> deadlines;
+
+public:
+	bool empty() { return times.empty(); }
+	size_t size() { return times.size(); }
+	size_t queued() { return deadlines.size(); }
+	// Make x expire at t
+	void set(const T &x, Time t) {
+		times[x] = t;
+		Deadline d = { t, x };
+		deadlines.push(d);
+	}
+	void erase(const T &x) { times.erase(x); }
+	bool contains(const T &x) { return times.count(x) > 0; }
+	// Has x expired by now?  False if x doesn't expire
+	bool expired(const T &x, Time now) {
+		typename Map::iterator it = times.find(x);
+		return it != times.end() && it->second <= now;
+	}
+	// Is there a deadline, stale or not, at or before now?
+	bool due(Time now) {
+		return !deadlines.empty() && deadlines.top().t <= now;
+	}
+	// Take the first deadline from the queue and, unless it was stale,
+	// store its value in x and return true
+	bool pop(T &x) {
+		Deadline d = deadlines.top();
+		deadlines.pop();
+		typename Map::iterator it = times.find(d.x);
+		if (it == times.end() || it->second != d.t)
+			return false;
+		x = d.x;
+		return true;
+	}
+	void clear() {
+		Map().swap(times);
+		deadlines = std::priority_queue<Deadline>();
+	}
+	// Move the values that are greater than or equal to x to t
+	void split(const T &x, ExpiryTable &t) {
+		typename Map::iterator it = times.begin();
+		while (it != times.end()) {
+			if (it->first < x) {
+				++it;
+				continue;
+			}
+			t.set(it->first, it->second);
+			it = times.erase(it);
+		}
+	}
+	// Move all of t's values here
+	void join(ExpiryTable &t) {
+		for (typename Map::iterator it = t.times.begin(); it != t.times.end();
+				++it)
+			set(it->first, it->second);
+		t.clear();
+	}
+};
+
+// The Expiry policies of TodoList4
+struct Untimed {
+	static const bool enabled = false;
+
+	template<class T, class Time>
+	struct Table {
+		bool empty() { return true; }
+		size_t size() { return 0; }
+		size_t queued() { return 0; }
+		void set(const T &x, Time t) { }
+		void erase(const T &x) { }
+		bool contains(const T &x) { return false; }
+		bool expired(const T &x, Time now) { return false; }
+		bool due(Time now) { return false; }
+		bool pop(T &x) { return false; }
+		void clear() { }
+		void split(const T &x, Table &t) { }
+		void join(Table &t) { }
+	};
+};
+
+struct Timed {
+	static const bool enabled = true;
+
+	template<class T, class Time>
+	using Table = ExpiryTable<T,Time>;
+};
+
+} // fastws namespace
+
+#endif // FASTWS_EXPIRY_H_
@@ -0,0 +1,291 @@
+/**
+ * (c) 2014 Pat Morin, Released under a CC BY 3.0 License:
+ *     https://creativecommons.org/licenses/by/3.0/
+ *
+ * ExternalTodoList.h : A todolist whose bottom level is on disk
+ *
+ * The lists of a todolist shrink geometrically as we go up, so for key
+ * sets that don't fit in RAM we keep only the top in memory.  The bottom
+ * level is a file of sorted keys, memory-mapped, with each page full but
+ * the last.  The levels above the cutoff are an in-memory TodoList4 of
+ * the first key of every page (the fences), each with its page number.
+ * The successor of x among the fences tells us which page x belongs in,
+ * so a find() reads exactly one page of the file.
+ *
+ * New keys go into an in-memory TodoList4, the insert buffer, which is
+ * merged into the file, by writing a new one, whenever it holds
+ * buffer_max keys.  Keys larger than any here can instead be appended to
+ * the file directly with append().
+ *
+ * An I/O error throws a std::system_error.  If it's thrown by merge() the
+ * list is as it was, except that the insert buffer may be full;
+ * otherwise the list can only be destroyed.
+ *
+ * T must be trivially copyable, since keys are stored as raw bytes.
+ */
+#ifndef FASTWS_EXTERNALTODOLIST_H_
+#define FASTWS_EXTERNALTODOLIST_H_
+
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <string>
+#include <system_error>
+#include <vector>
+#include <iterator>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "SortedArray.h"
+#include "TodoList4.h"
+
+namespace todolist {
+
+template<class T>
+class ExternalTodoList {
+protected:
+	static_assert(std::is_trivially_copyable<T>::value,
+			"ExternalTodoList keys must be trivially copyable");
+
+	std::string path;
+	int fd;
+	T *keys;        // the mapped file, holding keys[0,...,nkeys-1]
+	size_t nkeys;
+	size_t per_page;  // the number of keys in a page
+
+	// The first key of page p, keys[p*per_page].  Fences are compared by
+	// key alone
+	struct Fence {
+		T x;
+		size_t page;
+		bool operator<(const Fence &f) const { return x < f.x; }
+		bool operator==(const Fence &f) const { return x == f.x; }
+	};
+	TodoList4<Fence> *fences;
+	size_t pages;
+
+	TodoList4<T> *buffer; // keys that aren't in the file yet
+	size_t buffer_max;
+
+	size_t merges; // statistics
+
+	void fail(const char *what) {
+		throw std::system_error(errno, std::generic_category(),
+				std::string(what) + " " + path);
+	}
+	void map();
+	void unmap();
+	bool fileSuccessor(T x, T &y);
+
+public:
+	ExternalTodoList(const char *path0, size_t buffer_max0 = 1 << 20);
+	~ExternalTodoList();
+	T find(T x);
+	bool add(T x);
+	void append(T *data, size_t m);
+	void merge();
+	void evict();
+	int size() { return nkeys + buffer->size(); }
+	void printStats(std::ostream &out);
+};
+
+// Create an empty list, stored in a new file at path0 (which is truncated
+// if it exists)
+template<class T>
+ExternalTodoList<T>::ExternalTodoList(const char *path0, size_t buffer_max0)
+		: path(path0) {
+	fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		fail("can't create");
+	keys = NULL;
+	nkeys = 0;
+	per_page = max(1UL, sysconf(_SC_PAGESIZE) / sizeof(T));
+	fences = new TodoList4<Fence>();
+	pages = 0;
+	buffer = new TodoList4<T>();
+	buffer_max = max(1UL, buffer_max0);
+	merges = 0;
+}
+
+// The file stays where it is
+template<class T>
+ExternalTodoList<T>::~ExternalTodoList() {
+	unmap();
+	close(fd);
+	delete fences;
+	delete buffer;
+}
+
+template<class T>
+void ExternalTodoList<T>::map() {
+	if (nkeys == 0) return;
+	void *p = mmap(NULL, nkeys * sizeof(T), PROT_READ, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED)
+		fail("can't map");
+	// a find() reads one page, so there's no point reading ahead
+	madvise(p, nkeys * sizeof(T), MADV_RANDOM);
+	keys = (T *)p;
+}
+
+template<class T>
+void ExternalTodoList<T>::unmap() {
+	if (keys != NULL)
+		munmap(keys, nkeys * sizeof(T));
+	keys = NULL;
+}
+
+// Store the smallest key in the file that is greater than or equal to x
+// in y and return true, or return false if there isn't one.  Unless x is
+// a fence, the answer is in the page before the one whose fence is x's
+// successor or, failing that, it's that fence.
+template<class T>
+bool ExternalTodoList<T>::fileSuccessor(T x, T &y) {
+	Fence f = { x, 0 }, g;
+	bool next = fences->successor(f, g);
+	if (next && g.x == x) {
+		y = x;
+		return true;
+	}
+	size_t q = next ? g.page : pages;
+	if (q > 0) {
+		size_t lo = (q-1) * per_page;
+		size_t len = min(per_page, nkeys - lo);
+		size_t i = lowerBound(x, keys + lo, len);
+		if (i < len) {
+			y = keys[lo + i];
+			return true;
+		}
+	}
+	if (next) {
+		y = g.x;
+		return true;
+	}
+	return false;
+}
+
+template<class T>
+T ExternalTodoList<T>::find(T x) {
+	T a, b;
+	bool fa = fileSuccessor(x, a);
+	bool fb = buffer->successor(x, b);
+	if (fa && fb)
+		return (b < a) ? b : a;
+	return fa ? a : (fb ? b : T());
+}
+
+template<class T>
+bool ExternalTodoList<T>::add(T x) {
+	T y;
+	if (fileSuccessor(x, y) && y == x)
+		return false;
+	if (!buffer->add(x))
+		return false;
+	if ((size_t)buffer->size() >= buffer_max)
+		merge();
+	return true;
+}
+
+// Add data[0],...,data[m-1] to the end of the file.  They must be sorted,
+// distinct, and larger than any key already here
+template<class T>
+void ExternalTodoList<T>::append(T *data, size_t m) {
+	assert(nkeys == 0 || m == 0 || keys[nkeys-1] < data[0]);
+	const char *p = (const char *)data;
+	size_t bytes = m * sizeof(T);
+	off_t off = nkeys * sizeof(T);
+	while (bytes > 0) {
+		ssize_t w = pwrite(fd, p, bytes, off);
+		if (w <= 0)
+			fail("can't write");
+		p += w;
+		off += w;
+		bytes -= w;
+	}
+	for (size_t i = (nkeys + per_page - 1) / per_page * per_page;
+			i < nkeys + m; i += per_page) {
+		Fence f = { data[i - nkeys], pages++ };
+		fences->add(f);
+	}
+	unmap();
+	nkeys += m;
+	map();
+}
+
+// Write the file and the insert buffer, merged, to a new file that then
+// replaces the old one
+template<class T>
+void ExternalTodoList<T>::merge() {
+	if (buffer->size() == 0) return;
+	std::vector<T> b;
+	b.reserve(buffer->size());
+	buffer->copyTo(std::back_inserter(b));
+
+	std::string tmp = path + ".merge";
+	FILE *f = fopen(tmp.c_str(), "w");
+	if (f == NULL)
+		fail("can't create the merge file for");
+	std::vector<T> out;
+	out.reserve(per_page);
+	std::vector<Fence> fences2;
+	size_t i = 0, j = 0;
+	bool ok = true;
+	while (ok && (i < nkeys || j < b.size())) {
+		if (j == b.size() || (i < nkeys && keys[i] < b[j]))
+			out.push_back(keys[i++]);
+		else
+			out.push_back(b[j++]);
+		if (out.size() == per_page || (i == nkeys && j == b.size())) {
+			Fence g = { out[0], fences2.size() };
+			fences2.push_back(g);
+			ok = fwrite(out.data(), sizeof(T), out.size(), f) == out.size();
+			out.clear();
+		}
+	}
+	ok = (fclose(f) == 0) && ok;
+	// the old file is still mapped, so a rename() that fails leaves us as
+	// we were
+	int fd2 = ok && rename(tmp.c_str(), path.c_str()) == 0
+			? open(path.c_str(), O_RDWR) : -1;
+	if (fd2 < 0) {
+		int e = errno;
+		unlink(tmp.c_str());
+		errno = e;
+		fail("can't write the merge of");
+	}
+
+	unmap();
+	close(fd);
+	fd = fd2;
+	nkeys += b.size();
+	delete fences;
+	fences = new TodoList4<Fence>();
+	fences->buildFrom(fences2.begin(), fences2.end());
+	pages = fences2.size();
+	map();
+	delete buffer;
+	buffer = new TodoList4<T>();
+	merges++;
+}
+
+// Drop the file's pages from memory, so that the next finds read them
+// from disk
+template<class T>
+void ExternalTodoList<T>::evict() {
+	if (keys == NULL) return;
+	fdatasync(fd);
+	madvise(keys, nkeys * sizeof(T), MADV_DONTNEED);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+}
+
+template<class T>
+void ExternalTodoList<T>::printStats(std::ostream &out) {
+	out << "I: " << nkeys << " keys in " << pages << " pages on disk, "
+			<< buffer->size() << " in memory, " << merges << " merges" << endl;
+}
+
+} // fastws namespace
+
+#endif // FASTWS_EXTERNALTODOLIST_H_
@@ -0,0 +1,93 @@
+/**
+ * (c) 2014 Pat Morin, Released under a CC BY 3.0 License:
+ *     https://creativecommons.org/licenses/by/3.0/
+ *
+ * EytzingerArray.h : A static sorted set in Eytzinger (BFS) order
+ *
+ * The keys of a perfectly balanced binary search tree are stored in an array
+ * in breadth-first order, so the children of b[k] are b[2k] and b[2k+1].
+ * Searching is a branch-free descent and, since the 16 or so descendants of
+ * b[k] that are 4 levels down are contiguous, we can prefetch them long
+ * before we need them.
+ */
+#ifndef FASTWS_EYTZINGERARRAY_H_
+#define FASTWS_EYTZINGERARRAY_H_
+
+#include <cstdlib>
+#include <cassert>
+
+namespace todolist {
+
+template<class T>
+class EytzingerArray {
+protected:
+	// prefetch the descendants of b[k] that are this many times further along
+	const static size_t stride = sizeof(T) < 64 ? 64 / sizeof(T) : 1;
+
+	T *b;     // b[1],...,b[n] are the keys in BFS order, b[0] is unused
+	size_t n;
+
+	size_t build(T *data, size_t i, size_t k);
+
+public:
+	EytzingerArray(T *data, size_t n0);
+	~EytzingerArray();
+	int size() { return n; }
+	T find(T x);
+	size_t lowerBound(T x);
+	T get(size_t k) { return b[k]; }
+};
+
+template<class T>
+EytzingerArray<T>::EytzingerArray(T *data, size_t n0) {
+	n = n0;
+	void *p;
+	// cache-line aligned so that b[stride*k,...,stride*k+stride-1] is one line
+	if (posix_memalign(&p, 64, (n+1) * sizeof(T)) != 0)
+		abort();
+	b = (T *)p;
+	build(data, 0, 1);
+}
+
+template<class T>
+EytzingerArray<T>::~EytzingerArray() {
+	free(b);
+}
+
+// Do an in-order traversal of the implicit tree rooted at b[k], filling it
+// with data[i], data[i+1], ...  Returns the index of the next unused element
+template<class T>
+size_t EytzingerArray<T>::build(T *data, size_t i, size_t k) {
+	if (k <= n) {
+		i = build(data, i, 2*k);
+		b[k] = data[i++];
+		i = build(data, i, 2*k+1);
+	}
+	return i;
+}
+
+// Return the index k such that b[k] is the smallest value that is greater
+// than or equal to x. If no such value exists, then return 0.
+template<class T>
+size_t EytzingerArray<T>::lowerBound(T x) {
+	size_t k = 1;
+	while (k <= n) {
+		__builtin_prefetch(b + stride*k);
+		k = 2*k + (b[k] < x);
+	}
+	// the answer is the last place where we went left, so undo the trailing
+	// right turns (1 bits) and then the left turn (0 bit) that preceded them
+	return k >> __builtin_ffsl(~k);
+}
+
+// Return the smallest value that is greater than or equal to x. If no such
+// value exists, then return (T)0.
+template<class T>
+T EytzingerArray<T>::find(T x) {
+	size_t k = lowerBound(x);
+	return (k == 0) ? (T)0 : b[k];
+}
+
+} // fastws namespace
+
+#endif // FASTWS_EYTZINGERARRAY_H_
@@ -0,0 +1,190 @@
+/**
+ * (c) 2014 Pat Morin, Released under a CC BY 3.0 License:
+ *     https://creativecommons.org/licenses/by/3.0/
+ *
+ * HashIndex.h : A hash table from keys to the nodes that hold them
+ *
+ * An open-addressing table with linear probing, for answering exact-match
+ * queries on a TodoList4 in expected O(1) time.  Each slot holds a node
+ * and the C::Key of its value, as an NX does, so a probe only visits the
+ * node when the cached keys tie (see KeyCache.h).  Removal shifts the
+ * rest of the probe run back instead of leaving tombstones.  The table
+ * doubles once it is 3/4 full.
+ *
+ * T must have a std::hash, and Node must have a member x holding its key.
+ *
+ * A TodoList4 only keeps an index if its Index policy is HashIndexed.  With
+ * the default, NoIndex, its table is an empty stand-in, so T needn't have
+ * a std::hash.
+ */
+#ifndef FASTWS_HASHINDEX_H_
+#define FASTWS_HASHINDEX_H_
+
+#include <cstdlib>
+#include <cassert>
+#include <functional>
+#include <utility>
+#include <stdint.h>
+
+#include "KeyCache.h"
+
+namespace todolist {
+
+template<class T, class Node, class C = KeyCache<T> >
+class HashIndex {
+protected:
+	typedef typename C::Key Key;
+
+	struct Slot {
+		Node *u;   // NULL if the slot is empty
+		Key k;
+	};
+
+	Slot *t;
+	size_t cap;   // a power of 2, or 0
+	size_t used;
+
+	// Fibonacci hashing, so that weak hashes like std::hash<int> still
+	// spread over the whole table
+	size_t home(T &x) {
+		uint64_t hx = std::hash<T>()(x) * 0x9E3779B97F4A7C15ULL;
+		return (size_t)(hx >> 32) & (cap - 1);
+	}
+	size_t find(T &x, Key k);
+	void resize(size_t cap1);
+
+public:
+	HashIndex() : t(NULL), cap(0), used(0) { }
+	~HashIndex() { free(t); }
+	void clear();
+	void add(T &x, Node *u);
+	void move(T &x, Node *u);
+	Node *get(T &x);
+	Node **slot(T &x);
+	void erase(T &x);
+	void swap(HashIndex &o) {
+		std::swap(t, o.t);
+		std::swap(cap, o.cap);
+		std::swap(used, o.used);
+	}
+	size_t size() { return used; }
+	size_t bytes() { return cap * sizeof(Slot); }
+};
+
+// Return the slot holding x, or the empty slot that ends x's probe run
+template<class T, class Node, class C>
+size_t HashIndex<T,Node,C>::find(T &x, Key k) {
+	size_t i = home(x);
+	while (t[i].u != NULL && !C::equal(t[i].k, k, t[i].u, x))
+		i = (i + 1) & (cap - 1);
+	return i;
+}
+
+template<class T, class Node, class C>
+void HashIndex<T,Node,C>::resize(size_t cap1) {
+	Slot *t0 = t;
+	size_t cap0 = cap;
+	t = (Slot *)calloc(cap1, sizeof(Slot));
+	cap = cap1;
+	for (size_t j = 0; j < cap0; j++) {
+		if (t0[j].u == NULL) continue;
+		size_t i = home(t0[j].u->x);
+		while (t[i].u != NULL)
+			i = (i + 1) & (cap - 1);
+		t[i] = t0[j];
+	}
+	free(t0);
+}
+
+template<class T, class Node, class C>
+void HashIndex<T,Node,C>::clear() {
+	free(t);
+	t = NULL;
+	cap = used = 0;
+}
+
+// Map x, which isn't here, to u
+template<class T, class Node, class C>
+void HashIndex<T,Node,C>::add(T &x, Node *u) {
+	if (4*(used+1) > 3*cap)
+		resize(cap == 0 ? 16 : 2*cap);
+	Key k = C::key(x);
+	size_t i = find(x, k);
+	assert(t[i].u == NULL);
+	used++;
+	t[i].u = u;
+	t[i].k = k;
+}
+
+// Map x, which is here, to u instead.  Only the old node is looked at, so
+// this can be called before x moves to u
+template<class T, class Node, class C>
+void HashIndex<T,Node,C>::move(T &x, Node *u) {
+	size_t i = find(x, C::key(x));
+	assert(t[i].u != NULL);
+	t[i].u = u;
+}
+
+// Return the node x is mapped to, or NULL if there isn't one
+template<class T, class Node, class C>
+Node *HashIndex<T,Node,C>::get(T &x) {
+	if (used == 0) return NULL;
+	return t[find(x, C::key(x))].u;
+}
+
+// Return where x's node is stored, so that it can be changed after the
+// node has moved.  x must be here, and nothing may be added or erased
+// before the change
+template<class T, class Node, class C>
+Node **HashIndex<T,Node,C>::slot(T &x) {
+	size_t i = find(x, C::key(x));
+	assert(t[i].u != NULL);
+	return &t[i].u;
+}
+
+template<class T, class Node, class C>
+void HashIndex<T,Node,C>::erase(T &x) {
+	if (used == 0) return;
+	size_t i = find(x, C::key(x));
+	if (t[i].u == NULL) return;
+	used--;
+	// move back any later entry of the run whose home isn't in (i,j]
+	for (size_t j = (i + 1) & (cap - 1); t[j].u != NULL;
+			j = (j + 1) & (cap - 1)) {
+		size_t hj = home(t[j].u->x);
+		if (((j - hj) & (cap - 1)) >= ((j - i) & (cap - 1))) {
+			t[i] = t[j];
+			i = j;
+		}
+	}
+	t[i].u = NULL;
+}
+
+// The Index policies of TodoList4
+struct NoIndex {
+	static const bool enabled = false;
+
+	template<class T, class Node, class C>
+	struct Table {
+		void clear() { }
+		void add(T &x, Node *u) { }
+		void move(T &x, Node *u) { }
+		Node *get(T &x) { return NULL; }
+		Node **slot(T &x) { return NULL; }
+		void erase(T &x) { }
+		void swap(Table &o) { }
+		size_t size() { return 0; }
+		size_t bytes() { return 0; }
+	};
+};
+
+struct HashIndexed {
+	static const bool enabled = true;
+
+	template<class T, class Node, class C>
+	using Table = HashIndex<T,Node,C>;
+};
+
+} // fastws namespace
+
+#endif // FASTWS_HASHINDEX_H_
@@ -0,0 +1,98 @@
+/**
+ * (c) 2014 Pat Morin, Released under a CC BY 3.0 License:
+ *     https://creativecommons.org/licenses/by/3.0/
+ *
+ * KeyCache.h : What a todolist stores next to a pointer about its target
+ *
+ * TodoList4 stores, along with each next pointer, a Key that lets a search
+ * decide whether to follow the pointer without visiting the node it points
+ * to.  For most types this is a copy of the key itself.  For strings it is
+ * the first 8 bytes, packed big-endian into an integer so that integer
+ * order agrees with string order; only when two prefixes tie does the
+ * search have to look at the whole string.
+ *
+ * A Key must be trivially copyable, since nodes are copied with memcpy().
+ * Every list ends with top(), and if bounded is true then no Key is less
+ * than top(), so searches needn't check for the end of a list.
+ */
+#ifndef FASTWS_KEYCACHE_H_
+#define FASTWS_KEYCACHE_H_
+
+#include <cstring>
+#include <string>
+#include <algorithm>
+#include <stdint.h>
+
+#include "utils.h"
+
+namespace todolist {
+
+// Cache a copy of the whole key
+template<class T>
+struct KeyCache {
+	typedef T Key;
+	static const bool bounded = ods::Infinity<T>::exists;
+	static inline Key top() { return ods::Infinity<T>::value(); }
+	static inline Key key(T &x) { return x; }
+	// Is v->x < x, given c = key(v->x) and k = key(x)?
+	template<class Node>
+	static inline bool less(Key c, Key k, Node *v, T &x) { return c < k; }
+	// Is v->x == x, given c = key(v->x) and k = key(x)?
+	template<class Node>
+	static inline bool equal(Key c, Key k, Node *v, T &x) { return c == k; }
+	// Return v->x, given c = key(v->x)
+	template<class Node>
+	static inline T value(Key c, Node *v) { return c; }
+};
+
+// Cache nothing, so every comparison visits the node
+template<class T>
+struct NoKeyCache {
+	typedef char Key;
+	static const bool bounded = false;
+	static inline Key top() { return 0; }
+	static inline Key key(T &x) { return 0; }
+	template<class Node>
+	static inline bool less(Key c, Key k, Node *v, T &x) { return v->x < x; }
+	template<class Node>
+	static inline bool equal(Key c, Key k, Node *v, T &x) { return v->x == x; }
+	template<class Node>
+	static inline T value(Key c, Node *v) { return v->x; }
+};
+
+// Cache an 8-byte prefix of a string
+template<>
+struct KeyCache<std::string> {
+	typedef uint64_t Key;
+	// a prefix of all 0xff bytes doesn't bound strings that start with it
+	static const bool bounded = false;
+	static inline Key top() { return 0; }
+	static inline Key key(std::string &x) {
+		unsigned char buf[8] = { 0 };
+		memcpy(buf, x.data(), std::min(x.size(), sizeof(buf)));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		uint64_t k;
+		memcpy(&k, buf, sizeof(k));
+		return __builtin_bswap64(k);
+#else
+		Key k = 0;
+		for (size_t i = 0; i < sizeof(buf); i++)
+			k = (k << 8) | buf[i];
+		return k;
+#endif
+	}
+	template<class Node>
+	static inline bool less(Key c, Key k, Node *v, std::string &x) {
+		return c < k || (c == k && v->x < x);
+	}
+	template<class Node>
+	static inline bool equal(Key c, Key k, Node *v, std::string &x) {
+		return c == k && v->x == x;
+	}
+	template<class Node>
+	static inline std::string value(Key c, Node *v) { return v->x; }
+};
+
+} // fastws namespace
+
+#endif // FASTWS_KEYCACHE_H_
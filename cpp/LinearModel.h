@@ -0,0 +1,98 @@
+/**
+ * (c) 2014 Pat Morin, Released under a CC BY 3.0 License:
+ *     https://creativecommons.org/licenses/by/3.0/
+ *
+ * LinearModel.h : A piecewise linear model of a sorted array
+ *
+ * A learned index, in the style of Kraska et al.'s RMI and Ferragina and
+ * Vinciguerra's PGM-index.  The ranks of the keys are approximated by a
+ * piecewise linear function of the keys that is never off by more than err.
+ * The pieces are found greedily, by extending each one for as long as some
+ * slope keeps every key in it within err of its rank.  rank(x) evaluates
+ * the function and finishes with a binary search of about 2*err keys.
+ *
+ * Keys must be convertible to double, and distinct keys must convert to
+ * distinct doubles.
+ */
+#ifndef FASTWS_LINEARMODEL_H_
+#define FASTWS_LINEARMODEL_H_
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include "SortedArray.h"
+
+namespace todolist {
+
+template<class T>
+class LinearModel {
+protected:
+	struct Segment {
+		double x0;    // the segment's first key
+		size_t r0;    // and its rank
+		double slope;
+	};
+
+	std::vector<Segment> segs;
+	std::vector<T> keys;
+	size_t err;
+
+public:
+	LinearModel(size_t err0 = 8) : err(err0) { }
+	void train(T *data, size_t m);
+	size_t rank(T x);
+	size_t segments() { return segs.size(); }
+};
+
+// Fit a model to data[0],...,data[m-1], which must be sorted and distinct
+template<class T>
+void LinearModel<T>::train(T *data, size_t m) {
+	keys.assign(data, data + m);
+	segs.clear();
+	size_t s = 0;
+	while (s < m) {
+		double x0 = (double)keys[s];
+		double lo = 0, hi = INFINITY; // the slopes that work so far
+		size_t j;
+		for (j = s + 1; j < m; j++) {
+			double dx = (double)keys[j] - x0;
+			double l = ((double)(j - s) - err) / dx;
+			double u = ((double)(j - s) + err) / dx;
+			if (l > hi || u < lo) break;
+			lo = std::max(lo, l);
+			hi = std::min(hi, u);
+		}
+		Segment g = { x0, s, (j == s + 1) ? 0 : (lo + hi) / 2 };
+		segs.push_back(g);
+		s = j;
+	}
+}
+
+// Return the number of keys that are less than x
+template<class T>
+size_t LinearModel<T>::rank(T x) {
+	if (segs.empty()) return 0;
+	double d = (double)x;
+
+	// find the last segment that starts at or before x, if any
+	size_t a = 0, b = segs.size();
+	while (b - a > 1) {
+		size_t mid = (a + b) / 2;
+		if (segs[mid].x0 <= d) a = mid; else b = mid;
+	}
+	Segment &g = segs[a];
+	size_t end = (a + 1 < segs.size()) ? segs[a+1].r0 : keys.size();
+
+	// the rank is within err (plus rounding) of the prediction
+	double p = g.r0 + g.slope * (d - g.x0);
+	p = std::max((double)g.r0, std::min((double)end, p));
+	size_t pos = (size_t)p;
+	size_t lo = (pos > g.r0 + err + 1) ? pos - err - 1 : g.r0;
+	size_t hi = std::min(end, pos + err + 3);
+	return lo + lowerBound(x, keys.data() + lo, hi - lo);
+}
+
+} // fastws namespace
+
+#endif // FASTWS_LINEARMODEL_H_
@@ -13,9 +13,12 @@
  * - find(x) runs in O(log n) worst-case time and performs
  *   ceiling((1+epsilon)log n) comparisons.
  *
- * This particular implementation is a space hog.  Every element in the
- * structure has its own array of length k=Theta(log n)$.  This avoids the
- * resizing that would otherwise be required when rebuilding levels.
+ * In this implementation each list is a separate linked list whose nodes
+ * point down to the copy of the same key in the next list.  The nodes of
+ * each list live in one array (a pool) and next and down are indices into
+ * the pools.  Rebuilding a list writes it into its own pool in sorted
+ * order, so the pools are reused rather than freed and reallocated, and a
+ * freshly rebuilt list is a sequential walk through memory.
  */
 #ifndef FASTWS_LINKEDTODOLIST_H_
 #define FASTWS_LINKEDTODOLIST_H_
@@ -34,17 +37,24 @@ namespace todolist {
 template<class T>
 class LinkedTodoList {
 protected:
-	struct NP;
+	const static int nil = -1;
 
 	struct Node {
 		T x;         // data
-		Node *next;
-		Node *down;
+		int next;    // index of the next node in this list's pool
+		int down;    // index of the node for x in the next list's pool
+	};
+
+	// The pool holding list i.  pool[0] is the sentinel
+	struct Pool {
+		Node *nodes;
+		int used;      // nodes[0,...,used-1] are in use
+		int capacity;
 	};
 
 	int k;    // there are k+1 lists numbered 0,...,k
 	int *n;   // n[i] is the size of the i'th list
-	Node **sentinel; // sentinel-next[i] is the first element of list i
+	Pool *pools; // pools[i] holds the nodes of list i
 
 	// parameters used to determine lists sizes
 	double eps;
@@ -55,18 +65,17 @@ protected:
 	int *rebuild_freqs;
 
 	void init(T *data, int n);
-	void deleteList(Node *head);
 	void rebuild();
 	void rebuild(int i);
 
-	Node *newNode(T x, Node *down = NULL, Node *next = NULL);
-	void deleteNode(Node *u);
+	void reset(Pool &p, int capacity);
+	int newNode(int i, T x, int down = nil, int next = nil);
 
 	void sanity();
 
 public:
 	LinkedTodoList(double eps0 = .3, T *data = NULL, int n0 = 0);
-	virtual ~LinkedTodoList();
+	~LinkedTodoList();
 	T find(T x);
 	bool add(T x);
 	int size() {
@@ -97,68 +106,91 @@ void LinkedTodoList<T>::init(T *data, int n0) {
 	k = max(0.0, ceil(log(n0) / log(2-eps)));
 
 	n = new int[k + 1]();
-	sentinel = new Node*[k+1];
-	sentinel[k] = newNode((T)0);
-	for (int i = k-1; i >= 0; i--)
-		sentinel[i] = newNode((T)0, sentinel[i+1]);
+	pools = new Pool[k + 1];
+	for (int i = 0; i <= k; i++) {
+		pools[i].nodes = NULL;
+		reset(pools[i], 2);
+	}
+	reset(pools[k], n0 + 1);
 	n[k] = n0;
-	Node *next = NULL;
-	for (int j = n0-1; j >= 0; j--) {
-		Node *u = newNode(data[j], NULL, next);
-		next = u;
+	int prev = 0;
+	for (int j = 0; j < n0; j++) {
+		int u = newNode(k, data[j]);
+		pools[k].nodes[prev].next = u;
+		prev = u;
 	}
-	sentinel[k]->next = next;
 	rebuild(k);
 }
 
+// Empty p, leaving room for at least capacity nodes (including the sentinel)
 template<class T>
-typename LinkedTodoList<T>::Node* LinkedTodoList<T>::newNode(T x, Node *down,
-		Node *next) {
-	Node *u = new Node;
-	u->down = down;
-	u->next = next;
-	u->x = x;
-	return u;
-}
-
-template<class T>
-void LinkedTodoList<T>::deleteNode(Node *u) {
-	delete u;
+void LinkedTodoList<T>::reset(Pool &p, int capacity) {
+	if (p.nodes == NULL || p.capacity < capacity) {
+		delete[] p.nodes;
+		p.capacity = 2 * capacity;
+		p.nodes = new Node[p.capacity];
+	}
+	p.used = 1;
+	p.nodes[0].x = (T)0;
+	p.nodes[0].next = nil;
+	p.nodes[0].down = 0;
 }
 
+// Allocate a new node at the end of list i's pool and return its index
 template<class T>
-void LinkedTodoList<T>::deleteList(Node *head) {
-	Node *u = head, *next = NULL;
-	while (u != NULL) {
-		next = u->next;
-		deleteNode(u);
-		u = next;
+int LinkedTodoList<T>::newNode(int i, T x, int down, int next) {
+	Pool &p = pools[i];
+	if (p.used == p.capacity) {
+		Node *nodes = new Node[2 * p.capacity];
+		std::copy(p.nodes, p.nodes + p.used, nodes);
+		delete[] p.nodes;
+		p.nodes = nodes;
+		p.capacity *= 2;
 	}
+	int u = p.used++;
+	p.nodes[u].x = x;
+	p.nodes[u].down = down;
+	p.nodes[u].next = next;
+	return u;
 }
 
 template<class T>
 void LinkedTodoList<T>::rebuild() {
-	// delete all but the k'th list
-	for (int i = 0; i < k; i++) {
-		deleteList(sentinel[i]);
-		sentinel[i] = NULL;
-	}
-	// save these for later
+	// copy the k'th list, in order, into a new pool
 	int n0 = n[k];
-	Node *head = sentinel[k]->next;
+	Pool bottom;
+	bottom.nodes = NULL;
+	reset(bottom, n0 + 1);
+	Node *src = pools[k].nodes;
+	for (int u = src[0].next, prev = 0; u != nil; u = src[u].next) {
+		int w = bottom.used++;
+		bottom.nodes[w].x = src[u].x;
+		bottom.nodes[w].next = nil;
+		bottom.nodes[prev].next = w;
+		prev = w;
+	}
 
-	// start over with new paramters but the same list
+	// start over with new paramters, recycling the old pools for the new
+	// lists 0,...,k'-1 and freeing any that are left over
+	int k0 = k;
+	Pool *pools0 = pools;
 	delete[] n;
-	delete sentinel[k];
-	delete[] sentinel;
 	k = max(0.0, ceil(log(n0) / log(2-eps)));
 	n = new int[k + 1]();
-	sentinel = new Node*[k+1];
-	sentinel[k] = newNode((T)0);
-	for (int i = k-1; i >= 0; i--)
-		sentinel[i] = newNode((T)0, sentinel[i+1]);
+	pools = new Pool[k + 1];
+	for (int i = 0; i < k; i++) {
+		if (i <= k0) {
+			pools[i] = pools0[i];
+		} else {
+			pools[i].nodes = NULL;
+			reset(pools[i], 2);
+		}
+	}
+	for (int i = k; i <= k0; i++)
+		delete[] pools0[i].nodes;
+	delete[] pools0;
+	pools[k] = bottom;
 	n[k] = n0;
-	sentinel[k]->next = head;
 	rebuild(k);
 }
 
@@ -169,62 +201,73 @@ void LinkedTodoList<T>::rebuild(int i) {
 	rebuild_freqs[i]++;
 
 	for (int j = i - 1; j >= 0; j--) {
-		// populate L_j using L_{j+1}
-		deleteList(sentinel[j]->next);
+		// populate L_j using L_{j+1}, overwriting L_j's pool
+		reset(pools[j], n[j+1]/2 + 1);
 		n[j] = 0;
-		Node *u = sentinel[j+1]->next;
-		Node *prev = sentinel[j];
+		Node *below = pools[j+1].nodes;
+		Node *nodes = pools[j].nodes;
+		int prev = 0;
 		bool skipped = false;
-		while (u != NULL) {
+		for (int u = below[0].next; u != nil; u = below[u].next) {
 			if (skipped) {
-				prev->next = newNode(u->x, u);
-				prev = prev->next;
+				int w = pools[j].used++;
+				nodes[w].x = below[u].x;
+				nodes[w].down = u;
+				nodes[w].next = nil;
+				nodes[prev].next = w;
+				prev = w;
 				n[j]++;
 			}
 			skipped = !skipped;
-			u = u->next;
 		}
-		prev->next = NULL;
 	}
 
 }
 
 template<class T>
 T LinkedTodoList<T>::find(T x) {
-	Node *u = sentinel[0];
-	if (u->next != NULL && u->next->x < x)
-		u = u->next;
-	while (u->down != NULL) {
-		if (u->next != NULL && u->next->x < x)
-			u = u->next;
-		u = u->down;
+	int u = 0;
+	for (int i = 0; i <= k; i++) {
+		Node *nodes = pools[i].nodes;
+		int v = nodes[u].next;
+		if (v != nil && nodes[v].x < x)
+			u = v;
+		if (i < k)
+			u = nodes[u].down;
 	}
-	return (u->next == NULL) ? (T)0 : u->next->x;
+	Node *bottom = pools[k].nodes;
+	int v = bottom[u].next;
+	return (v == nil) ? (T)0 : bottom[v].x;
 }
 
 template<class T>
 bool LinkedTodoList<T>::add(T x) {
 	// do a search for x and keep track of the search path
-	Node *path[50]; // FIXME: hard upper-bound
-	Node *u = sentinel[0];
+	int path[50]; // FIXME: hard upper-bound
+	int u = 0;
 	int i;
 	for (i = 0; i <= k; i++) {
-		if (u->next != NULL && u->next->x < x)
-			u = u->next;
+		Node *nodes = pools[i].nodes;
+		int v = nodes[u].next;
+		if (v != nil && nodes[v].x < x)
+			u = v;
 		path[i] = u;
-		u = u->down;
+		if (i < k)
+			u = nodes[u].down;
 	}
 
 	// check if x is already here and, if so, abort
-	if (path[k]->next != NULL && path[k]->next->x == x)
+	Node *bottom = pools[k].nodes;
+	int v = bottom[path[k]].next;
+	if (v != nil && bottom[v].x == x)
 		return false;
 
 	// insert x everywhere along the search path
-	Node *down = NULL;
+	int down = nil;
 	for (i = k; i >= 0; i--) {
-		Node *w = newNode(x, down, path[i]->next);
+		int w = newNode(i, x, down, pools[i].nodes[path[i]].next);
+		pools[i].nodes[path[i]].next = w;
 		down = w;
-		path[i]->next = w;
 		n[i]++;
 	}
 
@@ -247,20 +290,24 @@ LinkedTodoList<T>::~LinkedTodoList() {
 	delete[] a;
 	delete[] rebuild_freqs;
 	for (int i = 0; i <= k; i++)
-		deleteList(sentinel[i]);
-	delete[] sentinel;
+		delete[] pools[i].nodes;
+	delete[] pools;
 }
 
 template<class T>
 void LinkedTodoList<T>::sanity() {
 	assert(n[0] <= n0max);
 	for (int i = 0; i <= k; i++) {
-		Node *u = sentinel;
+		Node *nodes = pools[i].nodes;
+		int u = 0;
 		for (int j = 0; j < n[i]; j++) {
-			assert(u == sentinel || u->x < u->next->x);
-			u = u->next[i];
+			int v = nodes[u].next;
+			assert(u == 0 || nodes[u].x < nodes[v].x);
+			if (i < k)
+				assert(pools[i+1].nodes[nodes[v].down].x == nodes[v].x);
+			u = v;
 		}
-		assert(u->next[i] == NULL);
+		assert(nodes[u].next == nil);
 	}
 }
 
@@ -271,12 +318,13 @@ void LinkedTodoList<T>::printOn(std::ostream &out) {
 	for (int i = 0; i <= k; i++) {
 		cout << "L(" << i << "): ";
 		if (n[k] <= max_print) {
-			Node *u = sentinel[i]->next;
+			Node *nodes = pools[i].nodes;
+			int u = nodes[0].next;
 			for (int j = 0; j < n[i]; j++) {
-				cout << u->x << ",";
-				u = u->next;
+				cout << nodes[u].x << ",";
+				u = nodes[u].next;
 			}
-			assert(u == NULL);
+			assert(u == nil);
 		}
 		cout << " n(" << i << ") = " << n[i]
 		     << " (rebuilt " << rebuild_freqs[i] << " times)" << endl;
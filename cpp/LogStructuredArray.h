@@ -0,0 +1,215 @@
+/**
+ * (c) 2014 Pat Morin, Released under a CC BY 3.0 License:
+ *     https://creativecommons.org/licenses/by/3.0/
+ *
+ * LogStructuredArray.h : A dynamic dictionary made of sorted arrays
+ *
+ * Bentley and Saxe's logarithmic method applied to SortedArray.  The keys
+ * are kept in O(log n) sorted runs whose sizes decrease geometrically; each
+ * run is at least twice as large as the next one.  add(x) makes a run of
+ * size 1 and, like incrementing a binary counter, merges it with the
+ * smallest runs until this is true again.
+ *
+ * - add(x) runs in O(log^2 n) time, O(log n) amortized of which is merging.
+ * - find(x) searches every run, in O(log^2 n) time.
+ *
+ * Optionally, each run of 64 or more keys gets an Eytzinger copy that is
+ * used for searching, and a background thread can take over the merges of
+ * large runs so add() never has to wait for them.
+ */
+#ifndef FASTWS_LOGSTRUCTUREDARRAY_H_
+#define FASTWS_LOGSTRUCTUREDARRAY_H_
+
+#include <cstdlib>
+#include <cassert>
+#include <algorithm>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "SortedArray.h"
+#include "EytzingerArray.h"
+
+namespace todolist {
+
+template<class T>
+class LogStructuredArray {
+protected:
+	// Global constants
+	const static size_t eytzinger_min = 64;        // smaller runs don't need it
+	const static size_t background_min = 1 << 16; // merges left to the thread
+
+	// A sorted run of keys, with an optional Eytzinger copy for searching
+	struct Run {
+		T *data;
+		SortedArray<T> sa;
+		EytzingerArray<T> *ea;
+		size_t n;
+
+		Run(T *data0, size_t n0, bool eytzinger) : data(data0), sa(data0, n0) {
+			n = n0;
+			ea = (eytzinger && n >= eytzinger_min)
+					? new EytzingerArray<T>(data, n) : NULL;
+		}
+		~Run() {
+			delete ea;
+			delete[] data;
+		}
+		// Set y to the smallest value >= x and return true, if there is one
+		bool find(T x, T &y) {
+			if (ea != NULL) {
+				size_t k = ea->lowerBound(x);
+				if (k == 0) return false;
+				y = ea->get(k);
+			} else {
+				size_t i = sa.lowerBound(x);
+				if (i == n) return false;
+				y = sa.get(i);
+			}
+			return true;
+		}
+	};
+	typedef std::shared_ptr<Run> RunPtr;
+
+	std::vector<RunPtr> runs; // runs[0] is the largest run
+	size_t n;                 // total number of keys
+	bool eytzinger;           // give large runs an Eytzinger copy
+	size_t inline_max;        // add() doesn't merge runs this large or larger
+
+	// State for the background compaction thread; when it is running,
+	// every operation on runs is done while holding m
+	bool background;
+	bool stopping;
+	std::mutex m;
+	std::condition_variable cv;
+	std::thread compactor;
+
+	static T *merge(Run *r, T *carry, size_t cn);
+	int findPair();
+	void compact();
+
+public:
+	LogStructuredArray(bool eytzinger0 = false, bool background0 = false);
+	~LogStructuredArray();
+	T find(T x);
+	bool add(T x);
+	int size() { return n; }
+};
+
+template<class T>
+LogStructuredArray<T>::LogStructuredArray(bool eytzinger0, bool background0) {
+	n = 0;
+	eytzinger = eytzinger0;
+	background = background0;
+	stopping = false;
+	inline_max = background ? background_min : (size_t)-1;
+	if (background)
+		compactor = std::thread(&LogStructuredArray<T>::compact, this);
+}
+
+template<class T>
+LogStructuredArray<T>::~LogStructuredArray() {
+	if (background) {
+		{
+			std::lock_guard<std::mutex> lock(m);
+			stopping = true;
+		}
+		cv.notify_one();
+		compactor.join();
+	}
+}
+
+// Return a new array holding the keys of r and carry[0,...,cn-1] in order
+template<class T>
+T *LogStructuredArray<T>::merge(Run *r, T *carry, size_t cn) {
+	T *c = new T[r->n + cn];
+	std::merge(r->data, r->data + r->n, carry, carry + cn, c);
+	return c;
+}
+
+// Return the index i of the last pair of runs with runs[i] less than twice
+// as big as runs[i+1], or -1 if there is no such pair
+template<class T>
+int LogStructuredArray<T>::findPair() {
+	for (int i = (int)runs.size() - 2; i >= 0; i--)
+		if (runs[i]->n < 2*runs[i+1]->n)
+			return i;
+	return -1;
+}
+
+// The background thread: merge pairs of runs that add() left alone. The
+// merge itself is done without holding m, so add() may have merged away the
+// smaller of the two runs by the time we're done; then we just try again.
+template<class T>
+void LogStructuredArray<T>::compact() {
+	std::unique_lock<std::mutex> lock(m);
+	while (true) {
+		int i;
+		while (!stopping && (i = findPair()) < 0)
+			cv.wait(lock);
+		if (stopping) return;
+		RunPtr a = runs[i], b = runs[i+1];
+		lock.unlock();
+		RunPtr ab(new Run(merge(a.get(), b->data, b->n), a->n + b->n,
+				eytzinger));
+		lock.lock();
+		if (i+1 < (int)runs.size() && runs[i] == a && runs[i+1] == b) {
+			runs[i] = ab;
+			runs.erase(runs.begin() + i + 1);
+		}
+	}
+}
+
+template<class T>
+T LogStructuredArray<T>::find(T x) {
+	std::unique_lock<std::mutex> lock(m, std::defer_lock);
+	if (background) lock.lock();
+	bool found = false;
+	T ans = (T)0;
+	for (size_t i = 0; i < runs.size(); i++) {
+		T y;
+		if (runs[i]->find(x, y) && (!found || y < ans)) {
+			ans = y;
+			found = true;
+		}
+	}
+	return ans;
+}
+
+template<class T>
+bool LogStructuredArray<T>::add(T x) {
+	std::unique_lock<std::mutex> lock(m, std::defer_lock);
+	if (background) lock.lock();
+
+	// abort if x is already here
+	for (size_t i = 0; i < runs.size(); i++) {
+		T y;
+		if (runs[i]->find(x, y) && y == x)
+			return false;
+	}
+
+	// carry x into the runs, like adding 1 to a binary counter
+	T *carry = new T[1];
+	carry[0] = x;
+	size_t cn = 1;
+	while (!runs.empty() && runs.back()->n < 2*cn
+			&& runs.back()->n < inline_max) {
+		T *c = merge(runs.back().get(), carry, cn);
+		cn += runs.back()->n;
+		delete[] carry;
+		carry = c;
+		runs.pop_back();
+	}
+	runs.push_back(RunPtr(new Run(carry, cn, eytzinger)));
+	n++;
+
+	if (background && runs.size() > 1 && runs[runs.size()-2]->n < 2*cn)
+		cv.notify_one();
+	return true;
+}
+
+} // fastws namespace
+
+#endif // FASTWS_LOGSTRUCTUREDARRAY_H_
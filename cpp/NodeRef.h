@@ -0,0 +1,255 @@
+/**
+ * (c) 2014 Pat Morin, Released under a CC BY 3.0 License:
+ *     https://creativecommons.org/licenses/by/3.0/
+ *
+ * NodeRef.h : How the next pointers of a TodoList4 refer to nodes
+ *
+ * With the default Refs policy, PointerRefs, a next pointer is a Node* and
+ * nodes come from malloc().  With CompactRefs it is a CompactRef, the
+ * node's 32-bit offset in the Region, counted in 8-byte units, so an NX
+ * for an int key takes 8 bytes instead of 16.  Offset 0 is NULL.
+ *
+ * The Region is 2^32 units (32GB) of address space, reserved the first
+ * time it's used and committed only as it's written.  So that a
+ * CompactRef can be turned back into a Node* without knowing which list
+ * it's in, every list in the process shares it: that's the real cap, 32GB
+ * of nodes in all.  An int node takes at least 2 units, so that's under
+ * 2 billion int nodes, not the 4 billion that 32 bits could count.
+ *
+ * Each list allocates from an Arena of its own, which takes 1MB segments
+ * of the Region as it needs them, and only that takes a lock.  Freed
+ * pieces go on free lists by size; TodoList4 only asks for a few sizes, so
+ * they aren't coalesced.  When a list goes away its Arena gives its
+ * segments back to the Region and their memory back to the system.  Lists
+ * that swap nodes, by split() or join(), merge() their Arenas, which then
+ * last until the last of those lists goes away.
+ */
+#ifndef FASTWS_NODEREF_H_
+#define FASTWS_NODEREF_H_
+
+#include <cstdlib>
+#include <cstddef>
+#include <new>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <stdint.h>
+#include <sys/mman.h>
+
+namespace todolist {
+
+template<class Dummy = void>
+class RegionOf {
+protected:
+	static char *base;
+	static size_t used;                 // segments handed out, including 0
+	static std::vector<uint32_t> spare; // segments given back
+	static std::mutex lock;
+
+public:
+	const static size_t unit_shift = 3;
+	const static size_t unit = 1 << unit_shift;
+	const static size_t segment_shift = 20;
+	const static size_t segment_size = 1 << segment_shift;
+	const static size_t segments = (size_t)1 << (32 + unit_shift)
+			>> segment_shift;
+
+	static inline void *at(uint32_t off) {
+		return (off == 0) ? NULL : base + ((size_t)off << unit_shift);
+	}
+	static inline uint32_t offset(const void *p) {
+		return (p == NULL) ? 0 : ((const char *)p - base) >> unit_shift;
+	}
+
+	// Get a segment, aligned to segment_size.  Segment 0 holds offset 0,
+	// so it's never handed out
+	static char *segment() {
+		std::lock_guard<std::mutex> g(lock);
+		if (base == NULL) {
+			size_t bytes = segments << segment_shift;
+			void *p = mmap(NULL, bytes + segment_size, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+			if (p == MAP_FAILED)
+				throw std::bad_alloc();
+			base = (char *)(((uintptr_t)p + segment_size - 1)
+					& ~(uintptr_t)(segment_size - 1));
+			used = 1;
+		}
+		size_t s;
+		if (!spare.empty()) {
+			s = spare.back();
+			spare.pop_back();
+		} else if (used < segments) {
+			s = used++;
+		} else {
+			throw std::bad_alloc();
+		}
+		return base + (s << segment_shift);
+	}
+	// Give back a segment and the memory behind it
+	static void release(char *p) {
+		madvise(p, segment_size, MADV_DONTNEED);
+		std::lock_guard<std::mutex> g(lock);
+		spare.push_back((p - base) >> segment_shift);
+	}
+};
+
+template<class D> char *RegionOf<D>::base = NULL;
+template<class D> size_t RegionOf<D>::used = 0;
+template<class D> std::vector<uint32_t> RegionOf<D>::spare;
+template<class D> std::mutex RegionOf<D>::lock;
+
+typedef RegionOf<> Region;
+
+// A reference to a Node in the Region, which converts to and from Node*
+template<class Node>
+class CompactRef {
+protected:
+	uint32_t off;
+public:
+	CompactRef() { }
+	CompactRef(Node *u) : off(Region::offset(u)) { }
+	inline operator Node*() const { return (Node *)Region::at(off); }
+	inline Node *operator->() const { return (Node *)Region::at(off); }
+};
+
+// The memory of one or more lists in the Region.  Pieces are carved from
+// one segment and blocks from another, so that blocks, whose size must be
+// a power of 2 no bigger than a segment, are aligned to their size
+class CompactArena {
+protected:
+	struct Free {
+		std::vector<uint32_t> heads; // heads[m] lists free pieces of m units
+		char *bump, *end;            // the rest of the current segment
+		Free() : bump(NULL), end(NULL) { }
+		void *take(size_t m) {
+			if (m < heads.size() && heads[m] != 0) {
+				void *p = Region::at(heads[m]);
+				heads[m] = *(uint32_t *)p;
+				return p;
+			}
+			return NULL;
+		}
+		void put(void *p, size_t m) {
+			if (m >= heads.size())
+				heads.resize(m + 1, 0);
+			*(uint32_t *)p = heads[m];
+			heads[m] = Region::offset(p);
+		}
+		// Put all of f's free pieces on our lists
+		void splice(Free &f) {
+			for (size_t m = 0; m < f.heads.size(); m++) {
+				while (f.heads[m] != 0)
+					put(f.take(m), m);
+			}
+		}
+	};
+	struct Pool {
+		std::shared_ptr<Pool> into; // the Pool this was merged into, if any
+		std::vector<char *> segments;
+		Free pieces, blocks;
+		~Pool() {
+			for (size_t i = 0; i < segments.size(); i++)
+				Region::release(segments[i]);
+		}
+		void *carve(Free &f, size_t bytes) {
+			if (f.bump == NULL || f.bump + bytes > f.end) {
+				f.bump = Region::segment();
+				f.end = f.bump + Region::segment_size;
+				segments.push_back(f.bump);
+			}
+			void *p = f.bump;
+			f.bump += bytes;
+			return p;
+		}
+	};
+	std::shared_ptr<Pool> pool;
+
+	Pool &root() {
+		while (pool->into)
+			pool = pool->into;
+		return *pool;
+	}
+	static inline size_t units(size_t bytes) {
+		return (bytes + Region::unit - 1) >> Region::unit_shift;
+	}
+
+public:
+	CompactArena() : pool(new Pool()) { }
+
+	void *allocate(size_t bytes) {
+		Pool &p = root();
+		void *u = p.pieces.take(units(bytes));
+		return (u != NULL) ? u : p.carve(p.pieces, units(bytes) * Region::unit);
+	}
+	void release(void *u, size_t bytes) {
+		root().pieces.put(u, units(bytes));
+	}
+	void *allocateBlock(size_t bytes) {
+		Pool &p = root();
+		void *b = p.blocks.take(units(bytes));
+		return (b != NULL) ? b : p.carve(p.blocks, bytes);
+	}
+	void releaseBlock(void *b, size_t bytes) {
+		root().blocks.put(b, units(bytes));
+	}
+	// Make this and a share one Pool.  The free pieces of a's move to ours;
+	// what was left of its current segments isn't used again
+	void merge(CompactArena &a) {
+		Pool &p = root(), &q = a.root();
+		if (&p == &q) return;
+		p.segments.insert(p.segments.end(), q.segments.begin(),
+				q.segments.end());
+		q.segments.clear();
+		p.pieces.splice(q.pieces);
+		p.blocks.splice(q.blocks);
+		q.into = pool;
+		a.pool = pool;
+	}
+};
+
+// Memory from malloc(), which any list can free.  Blocks are mapped on
+// their own and aligned to their size, as CompactArena's are; an aligned
+// malloc() of that size would leave a gap as big as the block next to it
+struct MallocArena {
+	void *allocate(size_t bytes) { return malloc(bytes); }
+	void *reallocate(void *u, size_t bytes) { return realloc(u, bytes); }
+	void release(void *u, size_t bytes) { free(u); }
+	void *allocateBlock(size_t bytes) {
+		void *p = mmap(NULL, 2*bytes, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			throw std::bad_alloc();
+		char *b = (char *)(((uintptr_t)p + bytes - 1) & ~(uintptr_t)(bytes - 1));
+		if (b > (char *)p)
+			munmap(p, b - (char *)p);
+		munmap(b + bytes, (char *)p + bytes - b);
+		return b;
+	}
+	void releaseBlock(void *b, size_t bytes) { munmap(b, bytes); }
+	void merge(MallocArena &a) { }
+};
+
+// The Refs policies of TodoList4.  Each says what a next pointer is, what
+// a list's Arena is, and the multiple of unit bytes that a node's size is
+// rounded up to, so nodes carved one after another stay aligned for their
+// references
+struct PointerRefs {
+	static const bool reallocates = true;
+	static const size_t unit = 1;
+
+	template<class Node> using Ref = Node*;
+	typedef MallocArena Arena;
+};
+
+struct CompactRefs {
+	static const bool reallocates = false;
+	static const size_t unit = Region::unit;
+
+	template<class Node> using Ref = CompactRef<Node>;
+	typedef CompactArena Arena;
+};
+
+} // fastws namespace
+
+#endif // FASTWS_NODEREF_H_
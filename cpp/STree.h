@@ -0,0 +1,129 @@
+/**
+ * (c) 2014 Pat Morin, Released under a CC BY 3.0 License:
+ *     https://creativecommons.org/licenses/by/3.0/
+ *
+ * STree.h : A static B-tree with one cache line per node
+ *
+ * The keys are stored in an implicit (B+1)-ary search tree with B = 16 keys
+ * per node, laid out in breadth-first order so the children of node k are
+ * nodes k(B+1)+1,...,k(B+1)+B+1.  There are no pointers.  Each node is
+ * searched by counting the keys that are less than x, which has no branches
+ * and, for int keys, is done with SIMD comparisons 4 or 8 keys at a time.
+ */
+#ifndef FASTWS_STREE_H_
+#define FASTWS_STREE_H_
+
+#include <cstdlib>
+#include <cassert>
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+namespace todolist {
+
+// Count the number of keys[0,...,15] that are less than x
+template<class T>
+struct STreeRank {
+	static inline unsigned rank(T *keys, T x) {
+		unsigned r = 0;
+		for (int j = 0; j < 16; j++)
+			r += (keys[j] < x);
+		return r;
+	}
+};
+
+#ifdef __SSE2__
+template<>
+struct STreeRank<int> {
+	static inline unsigned rank(int *keys, int x) {
+#ifdef __AVX2__
+		__m256i xv = _mm256_set1_epi32(x);
+		__m256i c0 = _mm256_cmpgt_epi32(xv, _mm256_load_si256((__m256i *)keys));
+		__m256i c1 = _mm256_cmpgt_epi32(xv, _mm256_load_si256((__m256i *)keys + 1));
+		unsigned mask = _mm256_movemask_ps(_mm256_castsi256_ps(c0))
+				| _mm256_movemask_ps(_mm256_castsi256_ps(c1)) << 8;
+#else
+		__m128i xv = _mm_set1_epi32(x);
+		unsigned mask = 0;
+		for (int j = 0; j < 4; j++) {
+			__m128i c = _mm_cmpgt_epi32(xv, _mm_load_si128((__m128i *)keys + j));
+			mask |= _mm_movemask_ps(_mm_castsi128_ps(c)) << (4*j);
+		}
+#endif
+		return __builtin_popcount(mask);
+	}
+};
+#endif
+
+template<class T>
+class STree {
+protected:
+	const static int B = 16;  // keys per node
+
+	T *keys;         // node k holds keys[k*B],...,keys[k*B+B-1]
+	size_t n;        // number of keys
+	size_t nblocks;  // number of nodes
+	T pad;           // fills unused slots in the last nodes
+
+	static inline size_t child(size_t k, unsigned i) {
+		return k*(B+1) + i + 1;
+	}
+	size_t build(T *data, size_t i, size_t k);
+
+public:
+	STree(T *data, size_t n0);
+	~STree();
+	int size() { return n; }
+	T find(T x);
+};
+
+template<class T>
+STree<T>::STree(T *data, size_t n0) {
+	n = n0;
+	nblocks = (n + B - 1) / B;
+	void *p;
+	if (posix_memalign(&p, 64, (nblocks+1) * B * sizeof(T)) != 0)
+		abort();
+	keys = (T *)p;
+	pad = (n > 0) ? data[n-1] : (T)0;
+	build(data, 0, 0);
+}
+
+template<class T>
+STree<T>::~STree() {
+	free(keys);
+}
+
+// Do an in-order traversal of the implicit tree rooted at node k, filling it
+// with data[i], data[i+1], ...  Since the slots past the last key are padded
+// with the largest key, every node remains sorted.
+template<class T>
+size_t STree<T>::build(T *data, size_t i, size_t k) {
+	if (k < nblocks) {
+		for (int j = 0; j < B; j++) {
+			i = build(data, i, child(k, j));
+			keys[k*B + j] = (i < n) ? data[i++] : pad;
+		}
+		i = build(data, i, child(k, B));
+	}
+	return i;
+}
+
+// Return the smallest value that is greater than or equal to x. If no such
+// value exists, then return (T)0.
+template<class T>
+T STree<T>::find(T x) {
+	T ans = (T)0;
+	size_t k = 0;
+	while (k < nblocks) {
+		unsigned i = STreeRank<T>::rank(keys + k*B, x);
+		if (i < B) ans = keys[k*B + i];
+		k = child(k, i);
+	}
+	return ans;
+}
+
+} // fastws namespace
+
+#endif // FASTWS_STREE_H_
@@ -25,6 +25,7 @@ protected:
 		Node *next[];
 	};
 	Node *sentinel;
+	Node *tail;     // every list ends here (see less(), below)
 	int h;
 	int n;
 	Node** stack;
@@ -33,14 +34,23 @@ protected:
 	void deleteNode(Node *u);
 	Node* findPredNode(T x);
 
+	// Is w->x < x?  If T has an Infinity then tail is a node holding it, so
+	// there's no need to check for the end of the list.  Otherwise tail is
+	// NULL
+	inline bool less(Node *w, T &x) {
+		return (Infinity<T>::exists || w != tail) && w->x < x;
+	}
+
 public:
 	SkiplistSSet();
 
 	virtual ~SkiplistSSet();
 
 	T find(T x);
+	void findBatch(T *xs, T *ans, size_t m, size_t g);
 	bool remove(T x);
 	bool add(T x);
+	T deleteMin();
 	int pickHeight();
 	void clear();
 	int size() { return n;	}
@@ -64,7 +74,7 @@ typename SkiplistSSet<T>::Node* SkiplistSSet<T>::findPredNode(T x) {
 	Node *u = sentinel;
 	int r = h;
 	while (r >= 0) {
-		while (u->next[r] != NULL && u->next[r]->x < x)
+		while (less(u->next[r], x))
 			u = u->next[r]; // go right in list r
 		r--; // go down into list r-1
 	}
@@ -76,7 +86,9 @@ SkiplistSSet<T>::SkiplistSSet() {
 	null = (T)0; // FIXME: requires T has integer constructor
 	n = 0;
 	sentinel = newNode(null, sizeof(int)*8);
-	memset(sentinel->next, '\0', sizeof(Node*)*sentinel->height);
+	tail = Infinity<T>::exists ? newNode(Infinity<T>::value(), 0) : NULL;
+	for (int i = 0; i <= sentinel->height; i++)
+		sentinel->next[i] = tail;
 	stack = new Node*[sentinel->height];
 	h = 0;
 }
@@ -85,6 +97,8 @@ template<class T>
 SkiplistSSet<T>::~SkiplistSSet() {
 	clear();
 	deleteNode(sentinel);
+	if (tail != NULL)
+		deleteNode(tail);
 	delete[] stack;
 }
 
@@ -93,11 +107,59 @@ T SkiplistSSet<T>::find(T x) {
 	Node *u = sentinel;
 	int r = h;
 	while (r >= 0) {
-		while (u->next[r] != NULL && u->next[r]->x < x)
+		while (less(u->next[r], x))
 			u = u->next[r]; // go right in list r
 		r--; // go down into list r-1
 	}
-	return u->next[0] == NULL ? null : u->next[0]->x;
+	return u->next[0] == tail ? null : u->next[0]->x;
+}
+
+/*
+ * Do m searches at once, storing the answer for xs[j] in ans[j].  Up to g
+ * searches are in flight.  They take turns doing one step each, and each
+ * step prefetches the node the search compares with next, so the g
+ * searches' cache misses overlap.  A search that finishes is replaced by
+ * the next.
+ */
+template<class T>
+void SkiplistSSet<T>::findBatch(T *xs, T *ans, size_t m, size_t g) {
+	const size_t gmax = 64;
+	struct Search {
+		size_t j;  // we're looking for xs[j]
+		Node *u;   // in list r, starting at u
+		int r;
+	} s[gmax];
+	if (g < 1) g = 1;
+	if (g > gmax) g = gmax;
+	size_t next = 0, k = 0;
+	while (k < g && next < m) {
+		s[k].j = next++;
+		s[k].u = sentinel;
+		s[k++].r = h;
+	}
+	while (k > 0) {
+		for (size_t q = 0; q < k; ) {
+			Search &c = s[q];
+			Node *w = c.u->next[c.r];
+			if (less(w, xs[c.j])) {
+				c.u = w;  // go right in list r
+			} else if (c.r-- == 0) {
+				// that was list 0, so w is the answer
+				ans[c.j] = (w == tail) ? null : w->x;
+				if (next < m) {
+					c.j = next++;
+					c.u = sentinel;
+					c.r = h;
+				} else {
+					c = s[--k];
+					continue;
+				}
+			}
+			if (c.u->next[c.r] != tail)
+				__builtin_prefetch(c.u->next[c.r]);
+			q++;
+		}
+	}
 }
 
 template<class T>
@@ -107,15 +169,15 @@ bool SkiplistSSet<T>::remove(T x) {
 	int r = h;
 	int comp = 0;
 	while (r >= 0) {
-		while (u->next[r] != NULL 
+		while (u->next[r] != tail
                && (comp = compare(u->next[r]->x, x)) < 0) {
 			u = u->next[r];
 		}
-		if (u->next[r] != NULL && comp == 0) {
+		if (u->next[r] != tail && comp == 0) {
 			removed = true;
 			del = u->next[r];
 			u->next[r] = u->next[r]->next[r];
-			if (u == sentinel && u->next[r] == NULL)
+			if (u == sentinel && u->next[r] == tail)
 				h--; // skiplist height has gone down
 		}
 		r--;
@@ -133,10 +195,10 @@ bool SkiplistSSet<T>::add(T x) {
 	int r = h;
 	int comp = 0;
 	while (r >= 0) {
-		while (u->next[r] != NULL 
+		while (u->next[r] != tail
                && (comp = compare(u->next[r]->x, x)) < 0)
 			u = u->next[r];
-		if (u->next[r] != NULL && comp == 0)
+		if (u->next[r] != tail && comp == 0)
 			return false;
 		stack[r--] = u;        // going down, store u
 	}
@@ -151,6 +213,24 @@ bool SkiplistSSet<T>::add(T x) {
 	return true;
 }
 
+/*
+ * Remove and return the smallest element, or return null if there isn't
+ * one.  It's first in every list it's in, so there's nothing to search.
+ */
+template<class T>
+T SkiplistSSet<T>::deleteMin() {
+	Node *u = sentinel->next[0];
+	if (u == tail) return null;
+	T x = u->x;
+	for (int r = 0; r <= u->height; r++)
+		sentinel->next[r] = u->next[r];
+	while (h > 0 && sentinel->next[h] == tail)
+		h--;
+	deleteNode(u);
+	n--;
+	return x;
+}
+
 template<class T>
 int SkiplistSSet<T>::pickHeight() {
 	int z = rand();
@@ -166,12 +246,13 @@ int SkiplistSSet<T>::pickHeight() {
 template<class T>
 void SkiplistSSet<T>::clear() {
 	Node *u = sentinel->next[0];
-	while (u != NULL) {
+	while (u != tail) {
 		Node *n = u->next[0];
 		deleteNode(u);
 		u = n;
 	}
-	memset(sentinel->next, '\0', sizeof(Node*)*h);
+	for (int i = 0; i <= h; i++)
+		sentinel->next[i] = tail;
 	h = 0;
 	n = 0;
 }
@@ -0,0 +1,102 @@
+/**
+ * (c) 2014 Pat Morin, Released under a CC BY 3.0 License:
+ *     https://creativecommons.org/licenses/by/3.0/
+ *
+ * SortedArray.h : Binary search in a sorted array
+ *
+ * The simplest static dictionary, and our default read-only table.  The
+ * searches are branch-free and there is a batched version that runs several
+ * independent searches at once to overlap their cache misses.
+ */
+#ifndef FASTWS_SORTEDARRAY_H_
+#define FASTWS_SORTEDARRAY_H_
+
+#include <cstdlib>
+#include <algorithm>
+
+namespace todolist {
+
+// Return the index of the smallest value in data[0,...,n-1] that is greater
+// than or equal to x. If no such value exists, then return n.
+// This is branch-free: every step moves base with a conditional move, so
+// there is nothing to mispredict, and the two places the next step might
+// look are prefetched while this step's comparison is being done.
+template<class T>
+size_t lowerBound(T x, T *data, size_t n) {
+	if (n == 0) return 0;
+	T *base = data;
+	size_t len = n;
+	while (len > 1) {
+		size_t half = len / 2;
+		len -= half;
+		__builtin_prefetch(base + len/2 - 1);
+		__builtin_prefetch(base + half + len/2 - 1);
+		base += (base[half-1] < x) * half;
+	}
+	return (base - data) + (*base < x);
+}
+
+// Return the smallest value that is greater than or equal to x. If no such
+// value exists, then return (T)0.
+template<class T>
+T binarySearch(T x, T *data, size_t n) {
+	size_t i = lowerBound(x, data, n);
+	return (i < n) ? data[i] : (T)0;
+}
+
+// Do m searches at once, storing the answer for xs[j] in ans[j].  The
+// searches on an array of length n all take the same number of steps, so
+// we run them in groups of g in lockstep; each step then has g independent
+// memory accesses in flight instead of one.
+template<class T>
+void binarySearchBatch(T *xs, T *ans, size_t m, T *data, size_t n, size_t g) {
+	const size_t gmax = 64;
+	T *base[gmax];
+	if (g < 1) g = 1;
+	if (g > gmax) g = gmax;
+	for (size_t j0 = 0; j0 < m; j0 += g) {
+		size_t k = std::min(g, m - j0);
+		if (n == 0) {
+			for (size_t j = 0; j < k; j++)
+				ans[j0+j] = (T)0;
+			continue;
+		}
+		for (size_t j = 0; j < k; j++)
+			base[j] = data;
+		size_t len = n;
+		while (len > 1) {
+			size_t half = len / 2;
+			len -= half;
+			for (size_t j = 0; j < k; j++) {
+				__builtin_prefetch(base[j] + len/2 - 1);
+				__builtin_prefetch(base[j] + half + len/2 - 1);
+				base[j] += (base[j][half-1] < xs[j0+j]) * half;
+			}
+		}
+		for (size_t j = 0; j < k; j++) {
+			size_t i = (base[j] - data) + (*base[j] < xs[j0+j]);
+			ans[j0+j] = (i < n) ? data[i] : (T)0;
+		}
+	}
+}
+
+// A sorted array of distinct values.  The array belongs to the caller.
+template<class T>
+class SortedArray {
+protected:
+	T *data;
+	size_t n;
+public:
+	SortedArray(T *data0, size_t n0) : data(data0), n(n0) {	}
+	int size() { return n; }
+	T find(T x) { return binarySearch(x, data, n); }
+	void findBatch(T *xs, T *ans, size_t m, size_t g) {
+		binarySearchBatch(xs, ans, m, data, n, g);
+	}
+	size_t lowerBound(T x) { return todolist::lowerBound(x, data, n); }
+	T get(size_t i) { return data[i]; }
+};
+
+} // fastws namespace
+
+#endif // FASTWS_SORTEDARRAY_H_
@@ -15,71 +15,406 @@
 #include <climits>
 #include <cassert>
 #include <iostream>
+#include <utility>
+#include <algorithm>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <stdint.h>
+
+#include "KeyCache.h"
+#include "TodoListBase.h"
+#include "LinearModel.h"
+#include "HashIndex.h"
+#include "Expiry.h"
+#include "NodeRef.h"
 
 namespace todolist {
 
 // TodoList4 - a top down skiplist. This version implments all the
-// performance enhancements and features described in the paper
-template<class T>
+// performance enhancements and features described in the paper.  Next to
+// each next pointer it keeps C::Key, which is enough to compare the key
+// it points to with the one we're looking for (see KeyCache.h).  I says
+// whether it can keep a hash index (see HashIndex.h), and E whether its
+// values can expire (see Expiry.h).  R says what a next pointer is and
+// where nodes come from (see NodeRef.h)
+template<class T, class C = KeyCache<T>, class I = NoIndex,
+		class E = Untimed, class R = PointerRefs>
 class TodoList4 {
+public:
+	typedef uint64_t Time;
+
 protected:
 	// Global constants
 	const static int hmax = 100;       // maximum number of levels
-	const static int space_factor = 8; // max pointers/keys per node
+	const static int compact_batch = 256; // nodes compact() looks at per call
+	const static size_t batch_max = 64; // searches findBatch() runs at once
 
 	// Structures related to nodes in our todolist
 	struct Node;
 
+	typedef typename C::Key Key;
+	typedef typename R::template Ref<Node> NodeRef;
+
 	struct NX {
-		Node *next;
-		T xnext;
+		NodeRef next;
+		Key xnext;
 	};
 
+	// type and count share a word, so an int node's header is 8 bytes
 	struct Node {
 		T x;      // data
-		size_t type; // FIXME: this only need represent 0,...,log log n
+		unsigned type : 8;   // size class, see in_block below
+		unsigned count : 24; // number of copies of x, in multiset mode
 		NX nx[];  // a stack of next pointers
 	};
+	const static unsigned max_count = (1 << 24) - 1;
+
+	// Bit set in Node::type for nodes that live in one of our blocks,
+	// rather than in memory of their own.  Blocks are aligned to their
+	// size, so a node's block is found by rounding its address down; it
+	// starts with a count of the live nodes in it.  A block is freed as
+	// soon as that count drops to 0 and we're done allocating from it.
+	const static size_t in_block = 1 << 3;
+	const static size_t type_mask = in_block - 1;
+	const static size_t has_expiry = 1 << 4; // see expiry below
+	const static size_t block_size = 1 << 16;
+	const static size_t block_header = 64;
 
 	// Instance variables
 	int h;    // there are h+1 lists numbered 0,...,h
 	int *n;   // n[i] is the size of the i'th list
 	Node *sentinel; // sentinel->nx[i].next is the first element of list i
 	size_t space; // the total size of all nodes
+	// Where our nodes and blocks come from (see NodeRef.h).  Lists that
+	// have taken each other's nodes by split() or join() share one.  Threads
+	// of buildFrom() take build_lock to get blocks from it
+	typename R::Arena arena;
+	std::mutex build_lock;
+	char *block, *bump; // we're allocating nodes from block, starting at bump
 
 	double eps; // the value of epsilon
 	int *a; // precomputed list size thresholds a[i] ~= (2-eps)^i
+	double space_factor; // max pointers/keys per node
+
+	// With incremental compaction, once space gets too high each add()
+	// calls compact() until it has made a full pass, and we only do a
+	// global rebuild if space gets twice as high. compact() continues from
+	// the first key >= resume, if resuming
+	bool incremental, compacting, resuming;
+	T resume;
+
+	// In multiset mode, add(x) counts the copies of x in its node, and there
+	// are dups copies in all beyond the first of each
+	bool multiset;
+	int dups;
+
+	// Set by buildWeighted(), whose lists are shaped for the key weights
+	// rather than balanced, so find() stops at the first list where it
+	// meets x.  The next global rebuild balances the lists and clears it.
+	bool biased;
+
+	// An optional learned index of list model_level, about half way up.
+	// find() gets x's predecessor in that list from it and descends from
+	// there.  Changing the list makes the model stale; it is retrained by
+	// rebuilds that rebuild its list, or after enough finds have missed it.
+	// Only keys that convert to double can be learned.  The model is off by
+	// default, and then find() doesn't go near it.
+	typedef std::integral_constant<bool,
+			std::is_convertible<T, double>::value> Learnable;
+	bool learned, model_fresh;
+	int model_level;
+	size_t stale_finds, retrains;
+	LinearModel<T> model;
+	std::vector<Node*> model_nodes;
+
+	// An optional hash table from each value to its node, for contains()
+	// and findExact(), if I is HashIndexed (see HashIndex.h).  Every node
+	// that moves or goes away updates it
+	bool hashed;
+	typename I::template Table<T,Node,C> hash_index;
+
+	// tail[i] is the last node of list i, if tails_valid, so that add()
+	// can append a value larger than all of ours without a search.  add()
+	// and rebuild(i) keep it up to date; other changes to the lists, by
+	// way of setHeight() or flush(), clear tails_valid, and the next add()
+	// finds the tails again
+	bool append, tails_valid;
+	Node *tail[hmax+1];
 
+	// If E is Timed, values added with add(x, t) expire at time t, which is
+	// kept in expiry rather than in the node, whose has_expiry bit is set.
+	// Once now >= t no search returns x.  x is removed by purgeExpired(),
+	// which takes values in order of expiry, by a global rebuild, which
+	// skips it, or by anything else that removes it.  size() counts values
+	// that have expired until they're removed.
+	typename E::template Table<T,Time> expiry;
+	Time now;
+
+	// After freeze(), the nodes are packed into one array as FNodes, which
+	// have no type or count and exactly as many FNXs as lists they're in.
+	// A node is referred to by its offset, in units of alignof(FNode), in
+	// 32 bits.  The sentinel is at offset 0, so a next of 0 ends a list.
+	// The tallest nodes come first, so the lists near the top, which every
+	// search reads, share a few cache lines.  In multiset mode counts[r] is
+	// the count of the value of rank r.  n and h are kept as they were
+	typedef uint32_t Ref;
+	struct FNX {
+		Key k;
+		Ref next;
+	};
+	struct FNode {
+		T x;
+		FNX nx[];
+	};
+	bool frozen;
+	char *packed;
+	size_t packed_units;
+	std::vector<unsigned> counts;
+
+	// An optional insert buffer: add() puts new values in this sorted
+	// vector, which flush() moves into the lists once it holds buffer_max
+	// of them, with one rebuild for the lot.  add() looks for x in both
+	// places, through the hash index if there is one, so it returns false
+	// for a value that's already here.  A buffered value that is in the
+	// lists, because it had expired or we're a multiset, is brought back
+	// or counted by flush().  find() looks in both places; every other
+	// operation, including size(), flushes first
+	std::vector<T> buffer;
+	size_t buffer_max;
+
+	// statistics: the number of global rebuilds caused by the size of list
+	// 0 and by the space used, and the number of nodes compact() shrunk
+	size_t size_rebuilds, space_rebuilds, compactions;
+
+	// A piece of the sorted input to buildFrom(), which one thread turns
+	// into nodes.  The chunk owns the distinct keys that first occur in
+	// keys[lo,...,hi-1]; rank of them come before its first one
+	struct Chunk {
+		size_t lo, hi;
+		size_t unique, rank;
+		size_t longest; // the most copies of one of its keys
+		size_t space, dups;
+		Node *first[hmax+1], *last[hmax+1]; // the chunk's part of each list
+	};
 
 	void init(T *data, int n);
+	void destroy();
+	void setHeight(int h1);
+	void rebalance();
+	size_t erase(Node **before, Node **last);
+	size_t unlink(Node **before, Node **last);
+	void countChunk(T *keys, size_t m, Chunk &c);
+	void buildChunk(T *keys, size_t m, Chunk &c);
+	int placeWeighted(const std::vector<double> &p, size_t lo, size_t hi,
+			int d, std::vector<int> &depth);
 	void rebuild();
 	void rebuild(int i);
+	void compact();
+	void shiftIndex(TodoList4<T,C,I,E,R> &t, Node *u);
+	void stamp(Node *u, const Time *t);
+	Node *searchPath(T x, Node **before);
+	size_t eraseNode(Node *w, Node **before);
+	void drop(Node *u);
+	// Has the value in u expired?  Always false unless E is Timed
+	bool expired(Node *u) {
+		return E::enabled && (u->type & has_expiry) && expiry.expired(u->x, now);
+	}
+	// Return the first node, starting at u, whose value hasn't expired
+	Node *unexpired(Node *u) {
+		while (u != NULL && expired(u))
+			u = u->nx[0].next;
+		return u;
+	}
+	bool insert(T x, const Time *t);
+	bool addBuffered(T x);
+	// Count one more copy of w's value, unless it has max_count already
+	inline bool countCopy(Node *w) {
+		if (w->count == max_count)
+			return false;
+		w->count++;
+		dups++;
+		return true;
+	}
+	bool addCopy(Node *w);
+	bool mergeBuffer();
+	bool findTails();
 
 	void sanity();  // internal consistence check - used for debugging
 
-	// Compute floor(log_2(h))
-	static inline size_t h2t(size_t h) {
-		return 8*sizeof(int) - __builtin_clz(h);
+	T findFrom(Node *u, int i, T &x);
+	T findLearned(T x);
+	T findFrozen(T x);
+	void findBatchFrozen(T *xs, T *ans, size_t m, size_t g);
+	void clearFrozen();
+	inline FNode *fat(Ref f) {
+		return (FNode *)(packed + (size_t)f * alignof(FNode));
+	}
+	// step() on the frozen array
+	inline Ref fstep(Ref u, int i, Key kx, T &x) {
+		FNX &nx = fat(u)->nx[i];
+		bool right = (C::bounded || nx.next != 0)
+				&& C::less(nx.k, kx, fat(nx.next), x);
+		return right ? nx.next : u;
+	}
+	// The units taken by a frozen node of the given height
+	static inline size_t funits(int height) {
+		return (sizeof(FNode) + (height + 1) * sizeof(FNX) + alignof(FNode) - 1)
+				/ alignof(FNode);
+	}
+
+	// Compute the type of a node of height h, i.e., ceil(log_2(h+1)); the
+	// size classes are SizeClassAlloc's
+	static inline size_t h2t(size_t h) { return SizeClassAlloc::h2t(h); }
+
+	// The number of next pointers in u and the bytes needed for a node type
+	static inline size_t slots(Node *u) {
+		return 1 << (u->type & type_mask);
+	}
+	static inline size_t nodeBytes(size_t type) {
+		return (sizeof(Node) + (1 << type) * sizeof(NX) + R::unit - 1)
+				/ R::unit * R::unit;
+	}
+
+	static inline size_t& live(char *b) {
+		return *(size_t *)b;
+	}
+	static inline char *blockOf(Node *u) {
+		return (char *)((uintptr_t)u & ~(uintptr_t)(block_size - 1));
+	}
+
+	// Empty m lists.  Each ends with C::top() which, if C::bounded, no key
+	// is less than, so searches needn't check for NULL
+	static inline void clearNX(NX *nx, size_t m) {
+		for (size_t j = 0; j < m; j++) {
+			nx[j].next = NULL;
+			nx[j].xnext = C::top();
+		}
+	}
+
+	// One step of a search for x (whose key is kx) in list i, from u.  The
+	// result is a conditional move rather than a branch
+	static inline Node *step(Node *u, int i, Key kx, T &x) {
+		NX &nx = u->nx[i];
+		bool right = (C::bounded || nx.next != NULL)
+				&& C::less(nx.xnext, kx, (Node *)nx.next, x);
+		return right ? (Node *)nx.next : u;
 	}
 
 	// Memory-management for Nodes
 	Node *newNode(size_t height);
+	Node *newBulkNode(size_t height);
+	Node *carveNode(size_t type, char *&blk, char *&bp,
+			std::mutex *lock = NULL);
 	Node *resizeNode(Node *u, size_t height);
+	Node *moveNode(Node *u, size_t type);
+	// Only a node whose value is trivially copyable can be realloc()ed,
+	// and only if R allows it; any other is moved
+	typedef std::integral_constant<bool,
+			std::is_trivially_copyable<T>::value && R::reallocates> Reallocable;
+	Node *reallocNode(Node *u, size_t type, std::true_type) {
+		Node **p = (hashed && u != sentinel) ? hash_index.slot(u->x) : NULL;
+		u = (Node *) arena.reallocate(u, nodeBytes(type & type_mask));
+		if (p != NULL)
+			*p = u;
+		return u;
+	}
+	Node *reallocNode(Node *u, size_t type, std::false_type) {
+		return moveNode(u, type);
+	}
 	void deleteNode(Node *u);
+	void releaseNode(Node *u);
+	void retireBlock();
+
+	Node *lowerBound(T x);
+
+	void train(std::true_type);
+	void train(std::false_type) { }
+	bool modelDue();
+	Node *modelPredecessor(T &x, std::true_type) {
+		size_t r = model.rank(x);
+		return (r == 0) ? sentinel : model_nodes[r-1];
+	}
+	Node *modelPredecessor(T &x, std::false_type) { return sentinel; }
 
 public:
 	TodoList4(double eps0 = .3, T *data = NULL, int n0 = 0);
-	virtual ~TodoList4();
+	~TodoList4();
 	T find(T x);
+	void findBatch(T *xs, T *ans, size_t m, size_t g);
 	bool add(T x);
-	const int size() { return n[0];	}
+	bool add(T x, Time t);
+	size_t purgeExpired(Time t, size_t work = SIZE_MAX);
+	template<class Iter> void buildFrom(Iter begin, Iter end, int threads = 1);
+	template<class Iter> void buildWeighted(Iter begin, Iter end);
+	const int size() {
+		if (!buffer.empty())
+			flush();
+		return n[0] + dups;
+	}
+	void setMultiset(bool b) { multiset = b; }
+	size_t count(T x);
+	std::pair<T,T> equalRange(T x);
+	bool successor(T x, T &y);
+	bool contains(T x);
+	bool findExact(T x, T &y);
+	bool remove(T x);
+	size_t eraseRange(T lo, T hi);
+	T peekMin() {
+		flush();
+		Node *m = unexpired(sentinel->nx[0].next);
+		return (m == NULL) ? T() : m->x;
+	}
+	T deleteMin();
+	TodoList4<T,C,I,E,R> *split(T x);
+	void join(TodoList4<T,C,I,E,R> &t);
+	template<class Out> Out copyTo(Out out);
 	void printOn(std::ostream &out);
+	void printStats(std::ostream &out);
+	void setSpaceFactor(double f) { space_factor = f; }
+	void setIncrementalCompaction(bool b) { incremental = b; }
+	void setLearned(bool b) {
+		learned = b && Learnable::value;
+		model_fresh = false;
+	}
+	void setHashIndex(bool b);
+	void setAppend(bool b) { append = b; }
+	void setBufferSize(size_t m) {
+		flush();
+		buffer_max = m;
+	}
+	void flush();
+	void freeze();
+	void thaw();
+	bool isFrozen() { return frozen; }
 };
 
-template<class T>
-TodoList4<T>::TodoList4(double eps0, T *data, int n0) {
+template<class T, class C, class I, class E, class R>
+TodoList4<T,C,I,E,R>::TodoList4(double eps0, T *data, int n0) {
 	eps = eps0;
 	space = 0;
+	block = bump = NULL;
+	space_factor = 8;
+	incremental = compacting = resuming = false;
+	multiset = false;
+	biased = false;
+	dups = 0;
+	learned = model_fresh = false;
+	model_level = 0;
+	hashed = false;
+	buffer_max = 0;
+	append = true;
+	tails_valid = false;
+	std::fill(tail, tail + hmax+1, (Node *)NULL);
+	now = 0;
+	frozen = false;
+	packed = NULL;
+	packed_units = 0;
+	stale_finds = retrains = 0;
+	size_rebuilds = space_rebuilds = compactions = 0;
 	double base_a = 2.0-eps;
 	a = new int[hmax+1];
 	for (int i = 0; i <= hmax; i++)
@@ -88,8 +423,8 @@ TodoList4<T>::TodoList4(double eps0, T *data, int n0) {
 	init(data, n0);
 }
 
-template<class T>
-void TodoList4<T>::init(T *data, int n0) {
+template<class T, class C, class I, class E, class R>
+void TodoList4<T,C,I,E,R>::init(T *data, int n0) {
 
 	// Compute critical values depending on epsilon and n
 	h = max(0.0, ceil(log(n0) / log(2-eps)));
@@ -99,65 +434,406 @@ void TodoList4<T>::init(T *data, int n0) {
 	sentinel = newNode(h);
 	Node *prev = sentinel;
 	for (int i = 0; i < n0; i++) {
-		Node *u = newNode(__builtin_ctz(i+1));
+		Node *u = newBulkNode(__builtin_ctz(i+1));
 		u->x = data[i];
 		prev->nx[0].next = u;
-		prev->nx[0].xnext = u->x;
+		prev->nx[0].xnext = C::key(u->x);
 		prev = u;
 	}
 	rebuild(0);
 }
 
-template<class T>
-typename TodoList4<T>::Node* TodoList4<T>::newNode(size_t height) {
+// Replace our contents with the keys in [begin,end), which needn't be
+// sorted or distinct.  The keys are sorted by threads threads, each of
+// which then builds every list for its own part of the sorted keys, in
+// blocks of its own.  A node's height depends only on its rank, so the
+// parts are independent and stitching them together takes O(threads*h)
+// time.  In multiset mode, duplicates are counted; otherwise dropped.
+template<class T, class C, class I, class E, class R> template<class Iter>
+void TodoList4<T,C,I,E,R>::buildFrom(Iter begin, Iter end, int threads) {
+	std::vector<T> keys(begin, end);
+	size_t m = keys.size();
+	size_t p = max(1, min(threads, (int)(m / 1024) + 1));
+	std::vector<Chunk> chunks(p);
+	for (size_t t = 0; t < p; t++) {
+		chunks[t].lo = m * t / p;
+		chunks[t].hi = m * (t+1) / p;
+	}
+	std::vector<std::thread> workers;
+
+	// sort the chunks, then merge them pairwise
+	T *k0 = keys.data();
+	for (size_t t = 0; t < p; t++) {
+		T *lo = k0 + chunks[t].lo, *hi = k0 + chunks[t].hi;
+		workers.push_back(std::thread([lo, hi] { std::sort(lo, hi); }));
+	}
+	for (size_t t = 0; t < p; t++)
+		workers[t].join();
+	for (size_t w = 1; w < p; w *= 2) {
+		workers.clear();
+		for (size_t t = 0; t + w < p; t += 2*w) {
+			T *lo = k0 + chunks[t].lo, *mid = k0 + chunks[t+w].lo;
+			T *hi = k0 + chunks[min(t+2*w, p)-1].hi;
+			workers.push_back(std::thread([lo, mid, hi] {
+					std::inplace_merge(lo, mid, hi); }));
+		}
+		for (size_t t = 0; t < workers.size(); t++)
+			workers[t].join();
+	}
+
+	// count each chunk's distinct keys to find the ranks of its first one,
+	// and give up before we've changed anything if one has too many copies
+	workers.clear();
+	for (size_t t = 0; t < p; t++)
+		workers.push_back(std::thread(&TodoList4::countChunk, this, keys.data(),
+				m, std::ref(chunks[t])));
+	for (size_t t = 0; t < p; t++)
+		workers[t].join();
+	size_t n0 = 0;
+	for (size_t t = 0; t < p; t++) {
+		chunks[t].rank = n0;
+		n0 += chunks[t].unique;
+		if (chunks[t].longest > max_count)
+			throw std::length_error("TodoList4::buildFrom(): too many copies");
+	}
+
+	// start over with the lists' sizes set for n0 keys
+	clearFrozen();
+	destroy();
+	buffer.clear();
+	tails_valid = false;
+	expiry.clear();
+	biased = false;
+	h = max(0.0, ceil(log(n0) / log(2-eps)));
+	n = new int[h + 1];
+	for (int i = 0; i <= h; i++)
+		n[i] = n0 >> i;
+	sentinel = newNode(h);
+	dups = 0;
+
+	workers.clear();
+	for (size_t t = 0; t < p; t++)
+		workers.push_back(std::thread(&TodoList4::buildChunk, this, keys.data(),
+				m, std::ref(chunks[t])));
+	for (size_t t = 0; t < p; t++)
+		workers[t].join();
+
+	// stitch the chunks' lists together
+	Node *prev[hmax+1];
+	for (int i = 0; i <= h; i++)
+		prev[i] = sentinel;
+	for (size_t t = 0; t < p; t++) {
+		Chunk &c = chunks[t];
+		for (int i = 0; i <= h; i++) {
+			if (c.first[i] == NULL) continue;
+			prev[i]->nx[i].next = c.first[i];
+			prev[i]->nx[i].xnext = C::key(c.first[i]->x);
+			prev[i] = c.last[i];
+		}
+		space += c.space;
+		dups += c.dups;
+	}
+	compacting = resuming = false;
+	model_fresh = false;
+	if (learned)
+		train(Learnable());
+	if (hashed)
+		setHashIndex(true);
+}
+
+// Replace our contents with the keys of the (key, weight) pairs in
+// [begin,end), shaped so that a search for a key of weight w out of a total
+// weight of W visits O(log(W/w)) nodes.  Every list but the bottom one has
+// at most one node between two consecutive nodes of the list above it, so
+// the lists are a binary search tree with the root in list h, and a key at
+// depth d goes into lists 0,...,h-d.  We pick each subtree's root so that
+// neither side has more than half its weight, and find() stops as soon as
+// it meets x, so x costs O(depth(x)) = O(log(W/w(x))).  Each weight is
+// first raised by W/n, so keys that are never queried are still at depth
+// O(log n).  The weights of repeated keys add up.  Later changes are
+// handled as usual, and the lists drift back toward balance.
+template<class T, class C, class I, class E, class R> template<class Iter>
+void TodoList4<T,C,I,E,R>::buildWeighted(Iter begin, Iter end) {
+	std::vector<std::pair<T,double> > kw(begin, end);
+	std::sort(kw.begin(), kw.end(), [](const std::pair<T,double> &a,
+			const std::pair<T,double> &b) { return a.first < b.first; });
+	size_t m = 0;
+	double total = 0;
+	for (size_t j = 0; j < kw.size(); j++) {
+		total += max(kw[j].second, 0.0);
+		if (m > 0 && kw[j].first == kw[m-1].first)
+			kw[m-1].second += max(kw[j].second, 0.0);
+		else
+			kw[m++] = std::make_pair(kw[j].first, max(kw[j].second, 0.0));
+	}
+	kw.resize(m);
+	double base = (total > 0) ? total / max(m, (size_t)1) : 1;
+	std::vector<double> p(m + 1); // p[j] is the weight of the first j keys
+	for (size_t j = 0; j < m; j++)
+		p[j+1] = p[j] + kw[j].second + base;
+	std::vector<int> depth(m);
+	int d = placeWeighted(p, 0, m, 0, depth);
+
+	clearFrozen();
+	destroy();
+	buffer.clear();
+	tails_valid = false;
+	expiry.clear();
+	h = max(max((double)d, ceil(log(m) / log(2-eps))), 0.0);
+	assert(h <= hmax);
+	n = new int[h + 1]();
+	sentinel = newNode(h);
+	dups = 0;
+	Node *prev[hmax+1];
+	for (int i = 0; i <= h; i++)
+		prev[i] = sentinel;
+	for (size_t j = 0; j < m; j++) {
+		int top = h - depth[j];
+		Node *u = newBulkNode(top);
+		u->x = kw[j].first;
+		Key k = C::key(u->x);
+		for (int i = 0; i <= top; i++) {
+			prev[i]->nx[i].next = u;
+			prev[i]->nx[i].xnext = k;
+			prev[i] = u;
+			n[i]++;
+		}
+	}
+	compacting = resuming = false;
+	model_fresh = false;
+	biased = true;
+	if (hashed)
+		setHashIndex(true);
+}
+
+// Give the keys lo,...,hi-1 their depths in the tree of buildWeighted(),
+// where p has their prefix weights, starting at depth d.  Return the
+// greatest depth, or d-1 if there are no keys
+template<class T, class C, class I, class E, class R>
+int TodoList4<T,C,I,E,R>::placeWeighted(const std::vector<double> &p, size_t lo,
+		size_t hi, int d, std::vector<int> &depth) {
+	if (lo >= hi)
+		return d-1;
+	// the root is the key whose weight straddles the middle of the range
+	double mid = (p[lo] + p[hi]) / 2;
+	size_t r = std::upper_bound(p.begin() + lo + 1, p.begin() + hi + 1, mid)
+			- p.begin() - 1;
+	r = min(max(r, lo), hi - 1);
+	depth[r] = d;
+	return max(placeWeighted(p, lo, r, d+1, depth),
+			placeWeighted(p, r+1, hi, d+1, depth));
+}
+
+// Count the distinct keys that first occur in c, in the sorted keys, and
+// the most copies of one of them, which can run on past c
+template<class T, class C, class I, class E, class R>
+void TodoList4<T,C,I,E,R>::countChunk(T *keys, size_t m, Chunk &c) {
+	c.unique = c.longest = 0;
+	for (size_t j = c.lo; j < c.hi; j++) {
+		if (j > 0 && keys[j] == keys[j-1]) continue;
+		c.unique++;
+		size_t k = j + 1;
+		for (; multiset && k < m && keys[k] == keys[j]; k++);
+		c.longest = max(c.longest, k - j);
+	}
+}
+
+// Make the nodes for c's distinct keys and link them into c's part of
+// each list.  The key of rank r goes into lists 0,...,ctz(r+1), as in
+// rebuild(0)
+template<class T, class C, class I, class E, class R>
+void TodoList4<T,C,I,E,R>::buildChunk(T *keys, size_t m, Chunk &c) {
+	for (int i = 0; i <= h; i++)
+		c.first[i] = c.last[i] = NULL;
+	c.space = c.dups = 0;
+	char *blk = NULL, *bp = NULL;
+	size_t q = c.rank + 1;
+	for (size_t j = c.lo; j < c.hi; j++) {
+		if (j > 0 && keys[j] == keys[j-1]) continue;
+		int top = __builtin_ctz(q++);
+		size_t type = h2t(top);
+		Node *u = carveNode(type, blk, bp, &build_lock);
+		c.space += 1 << type;
+		u->x = keys[j];
+		for (size_t k = j+1; multiset && k < m && keys[k] == keys[j]; k++) {
+			u->count++;
+			c.dups++;
+		}
+		for (int i = 0; i <= top; i++) {
+			if (c.last[i] == NULL) {
+				c.first[i] = u;
+			} else {
+				c.last[i]->nx[i].next = u;
+				c.last[i]->nx[i].xnext = C::key(u->x);
+			}
+			c.last[i] = u;
+		}
+	}
+}
+
+template<class T, class C, class I, class E, class R>
+typename TodoList4<T,C,I,E,R>::Node* TodoList4<T,C,I,E,R>::newNode(size_t height) {
 	size_t type = h2t(height);
 	size_t m = 1 << type;
-	Node *u = (Node *) malloc(sizeof(Node) + m * sizeof(NX));
+	Node *u = (Node *) arena.allocate(nodeBytes(type));
+	new (&u->x) T();
 	u->type = type;
+	u->count = 1;
 	space += m;
-	memset(u->nx, '\0', m * sizeof(NX));
+	clearNX(u->nx, m);
 	return u;
 }
 
-template<class T>
-typename TodoList4<T>::Node* TodoList4<T>::resizeNode(Node *u, size_t height) {
-	space -= 1 << u->type;
+// Allocate a node at the end of the newest block.  Consecutive calls return
+// consecutive nodes, so nodes allocated in sorted order are stored in
+// sorted order.
+template<class T, class C, class I, class E, class R>
+typename TodoList4<T,C,I,E,R>::Node* TodoList4<T,C,I,E,R>::newBulkNode(size_t height) {
 	size_t type = h2t(height);
-	size_t m = 1 << type;
-	u = (Node *) realloc(u, sizeof(Node) + m * sizeof(NX));
+	if (block != NULL && bump + nodeBytes(type) > block + block_size)
+		retireBlock();
+	space += 1 << type;
+	return carveNode(type, block, bump);
+}
+
+// Allocate a node of the given type at bp in block blk, starting a new
+// block if blk is NULL or full.  Threads that share our arena pass a lock
+// to take while they get a block from it
+template<class T, class C, class I, class E, class R>
+typename TodoList4<T,C,I,E,R>::Node* TodoList4<T,C,I,E,R>::carveNode(size_t type,
+		char *&blk, char *&bp, std::mutex *lock) {
+	size_t bytes = nodeBytes(type);
+	if (blk == NULL || bp + bytes > blk + block_size) {
+		if (lock != NULL) {
+			std::lock_guard<std::mutex> g(*lock);
+			blk = (char *) arena.allocateBlock(block_size);
+		} else {
+			blk = (char *) arena.allocateBlock(block_size);
+		}
+		live(blk) = 0;
+		bp = blk + block_header;
+	}
+	Node *u = (Node *)bp;
+	bp += bytes;
+	live(blk)++;
+	clearNX(u->nx, 1 << type);
+	new (&u->x) T();
+	u->type = type | in_block;
+	u->count = 1;
+	return u;
+}
+
+template<class T, class C, class I, class E, class R>
+typename TodoList4<T,C,I,E,R>::Node* TodoList4<T,C,I,E,R>::resizeNode(Node *u, size_t height) {
+	size_t m0 = slots(u);
+	space -= m0;
+	size_t type = h2t(height) | (u->type & has_expiry);
+	size_t m = 1 << (type & type_mask);
+	// a node in a block can't be realloc()ed
+	if (u->type & in_block)
+		u = moveNode(u, type);
+	else
+		u = reallocNode(u, type, Reallocable());
 	u->type = type;
 	space += m;
 	return u;
 }
 
-template<class T>
-void TodoList4<T>::deleteNode(Node *u) {
-	space -= 1 << u->type;
-	free(u);
+// Move u to a node of its own of the given type, and free u
+template<class T, class C, class I, class E, class R>
+typename TodoList4<T,C,I,E,R>::Node* TodoList4<T,C,I,E,R>::moveNode(Node *u, size_t type) {
+	Node *v = (Node *) arena.allocate(nodeBytes(type & type_mask));
+	if (hashed && u != sentinel)
+		hash_index.move(u->x, v);
+	new (&v->x) T(std::move(u->x));
+	v->count = u->count;
+	memcpy(v->nx, u->nx, min(slots(u), (size_t)1 << (type & type_mask))
+			* sizeof(NX));
+	u->x.~T();
+	releaseNode(u);
+	return v;
 }
 
-template<class T>
-void TodoList4<T>::rebuild() {
-	T *data = new T[n[0]];
-	Node *prev = sentinel;
-	Node *u = sentinel->nx[0].next;
-	for (int j = 0; j < n[0]; j++) {
-		data[j] = u->x;
-		deleteNode(prev);
-		prev = u;
-		u = u->nx[0].next;
+template<class T, class C, class I, class E, class R>
+void TodoList4<T,C,I,E,R>::deleteNode(Node *u) {
+	space -= slots(u);
+	u->x.~T();
+	releaseNode(u);
+}
+
+// Give back the memory used by u
+template<class T, class C, class I, class E, class R>
+void TodoList4<T,C,I,E,R>::releaseNode(Node *u) {
+	if (u->type & in_block) {
+		char *b = blockOf(u);
+		if (--live(b) == 0 && b != block)
+			arena.releaseBlock(b, block_size);
+	} else {
+		arena.release(u, nodeBytes(u->type & type_mask));
 	}
-	deleteNode(prev);
-	int enn = n[0];
+}
+
+// Stop allocating from the current block
+template<class T, class C, class I, class E, class R>
+void TodoList4<T,C,I,E,R>::retireBlock() {
+	if (block != NULL && live(block) == 0)
+		arena.releaseBlock(block, block_size);
+	block = bump = NULL;
+}
+
+// Rebuild everything from scratch. The new nodes are allocated in sorted
+// order and filled directly from the old nodes, which are freed as we go,
+// as are the old blocks once we've walked past them; there's no
+// intermediate copy of the keys and the new blocks can reuse the old ones.
+template<class T, class C, class I, class E, class R>
+void TodoList4<T,C,I,E,R>::rebuild() {
+	int n0 = n[0];
+	Node *w = sentinel->nx[0].next;
+	Key kw = sentinel->nx[0].xnext;
+	deleteNode(sentinel);
 	delete[] n;
-	init(data, enn);
-	delete[] data;
+	retireBlock();
+
+	h = max(0.0, ceil(log(n0) / log(2-eps)));
+	n = new int[h + 1]();
+	n[0] = n0;
+	sentinel = newNode(h);
+	biased = false;
+	Node *prev = sentinel;
+	int m = 0; // the values we've kept, leaving out those that expired
+	for (int i = 0; i < n0; i++) {
+		Node *next = w->nx[0].next;
+		Key knext = w->nx[0].xnext;
+		if (expired(w)) {
+			dups -= w->count - 1;
+			drop(w);
+		} else {
+			Node *u = newBulkNode(__builtin_ctz(++m));
+			if (hashed)
+				hash_index.move(w->x, u);
+			u->x = std::move(w->x);
+			u->count = w->count;
+			u->type |= w->type & has_expiry;
+			prev->nx[0].next = u;
+			prev->nx[0].xnext = kw;
+			prev = u;
+			deleteNode(w);
+		}
+		w = next;
+		kw = knext;
+	}
+	n[0] = m;
+	if (m < n0)
+		setHeight(max(0.0, ceil(log(m) / log(2-eps))));
+	compacting = resuming = false;
+	model_fresh = false;
+	rebuild(0);
 }
 
-template<class T>
-void TodoList4<T>::rebuild(int i) {
+template<class T, class C, class I, class E, class R>
+void TodoList4<T,C,I,E,R>::rebuild(int i) {
 	// this holds a list of all the predecessors of the current node
-	Node *prev[50];
+	Node *prev[hmax+1];
 	for (int j = i + 1; j <= h; j++) {
 		n[j] = 0;
 		prev[j] = sentinel;
@@ -169,21 +845,26 @@ void TodoList4<T>::rebuild(int i) {
 		int top = i + __builtin_ctz(q);
 		assert(top <= h);
 		Node *w = u;
+		Key ku = u->nx[i].xnext; // the key of u, so we needn't look at u->x
 		u = u->nx[i].next;
-		if (1 << u->type < top+1) { // resize node if it's not big enough
+		if (slots(u) < (size_t)top+1) { // resize node if it's not big enough
 			Node *u_new = resizeNode(u, top);
 			if (u_new != u) {
 				for (int j = i; j >= 0; j--) {
 					if (w->nx[j].next != u) w = w->nx[j].next;
 					w->nx[j].next = u_new;
+					if (tail[j] == u)
+						tail[j] = u_new;
 				}
 				u = u_new;
+				if (top >= model_level)
+					model_fresh = false;
 			}
 		}
 		for (int j = i+1; j <= top; j++) {
 			n[j]++;
 			prev[j]->nx[j].next = u;
-			prev[j]->nx[j].xnext = u->x;
+			prev[j]->nx[j].xnext = ku;
 			prev[j] = u;
 		}
 	}
@@ -191,67 +872,1173 @@ void TodoList4<T>::rebuild(int i) {
 	// every list finishes with nulls
 	for (int j = i+1; j <= h; j++) {
 			prev[j]->nx[j].next = NULL;
-			prev[j]->nx[j].xnext = (T)0;
+			prev[j]->nx[j].xnext = C::top();
+			tail[j] = prev[j];
 	}
+	tail[i] = u;
+	if (i == 0)
+		tails_valid = true;
+
+	// retrain the model if we just rebuilt its list
+	if (learned && i < h/2)
+		train(Learnable());
 }
 
-template<class T>
-T TodoList4<T>::find(T x) {
+// Look at the next compact_batch nodes, in key order, and shrink the ones
+// that are bigger than their height requires.  A node's height is found by
+// keeping its predecessor in every list.  A shrunk node moves to the end of
+// the current block, so nodes that are shrunk together stay together.
+template<class T, class C, class I, class E, class R>
+void TodoList4<T,C,I,E,R>::compact() {
+	Node *prev[hmax+1];
 	Node *u = sentinel;
-	for (int i = h; i >= 0; i--)
-		if (u->nx[i].next != NULL && u->nx[i].xnext < x)
+	Key kr = C::key(resume);
+	for (int i = h; i >= 0; i--) {
+		if (resuming && u->nx[i].next != NULL
+				&& C::less(u->nx[i].xnext, kr, (Node *)u->nx[i].next, resume))
 			u = u->nx[i].next;
-	return (u->nx[0].next == NULL) ? (T)0 : u->nx[0].xnext;
+		prev[i] = u;
+	}
+	for (int k = 0; k < compact_batch; k++) {
+		u = prev[0]->nx[0].next;
+		if (u == NULL) break;
+		int height = 0;
+		while (height < h && prev[height+1]->nx[height+1].next == u)
+			height++;
+		if (slots(u) > (1UL << h2t(height))) {
+			Node *u_new = newBulkNode(height);
+			if (hashed)
+				hash_index.move(u->x, u_new);
+			u_new->x = std::move(u->x);
+			u_new->count = u->count;
+			u_new->type |= u->type & has_expiry;
+			memcpy(u_new->nx, u->nx, (height+1) * sizeof(NX));
+			for (int j = 0; j <= height; j++) {
+				prev[j]->nx[j].next = u_new;
+				if (tail[j] == u)
+					tail[j] = u_new;
+			}
+			deleteNode(u);
+			u = u_new;
+			compactions++;
+			if (height >= model_level)
+				model_fresh = false;
+		}
+		for (int j = 0; j <= height; j++)
+			prev[j] = u;
+	}
+	// continue from here next time, unless we've made a full pass
+	u = prev[0]->nx[0].next;
+	resuming = compacting = (u != NULL);
+	if (resuming) resume = u->x;
 }
 
-template<class T>
-bool TodoList4<T>::add(T x) {
-	// search for x and keep track of the search path
-	Node *path[hmax]; // FIXME: hard upper-bound
+template<class T, class C, class I, class E, class R>
+T TodoList4<T,C,I,E,R>::find(T x) {
+	if (frozen)
+		return findFrozen(x);
+	if (learned && !biased)
+		return findLearned(x);
+	return findFrom(sentinel, h, x);
+}
+
+// find() with the learned model, if it's fresh or can be retrained
+template<class T, class C, class I, class E, class R>
+T TodoList4<T,C,I,E,R>::findLearned(T x) {
+	if (model_fresh || modelDue())
+		return findFrom(modelPredecessor(x, Learnable()), model_level - 1, x);
+	return findFrom(sentinel, h, x);
+}
+
+// Finish find(x) from u, x's predecessor in list i+1
+template<class T, class C, class I, class E, class R>
+T TodoList4<T,C,I,E,R>::findFrom(Node *u, int i, T &x) {
+	Key kx = C::key(x);
+	if (biased) {
+		// stop at the first list that has x
+		for (; i >= 0; i--) {
+			NX &nx = u->nx[i];
+			if (nx.next != NULL && C::equal(nx.xnext, kx, (Node *)nx.next, x)
+					&& !expired(nx.next))
+				return C::value(nx.xnext, (Node *)nx.next);
+			u = step(u, i, kx, x);
+		}
+	} else {
+		for (; i >= 0; i--)
+			u = step(u, i, kx, x);
+	}
+	NX nx = u->nx[0];
+	if (nx.next != NULL && expired(nx.next)) {
+		nx.next = unexpired(nx.next);
+		nx.xnext = (nx.next == NULL) ? C::top() : C::key(nx.next->x);
+	}
+	if (!buffer.empty()) {
+		typename std::vector<T>::iterator it
+				= std::lower_bound(buffer.begin(), buffer.end(), x);
+		if (it != buffer.end() && (nx.next == NULL
+				|| !C::less(nx.xnext, C::key(*it), (Node *)nx.next, *it)))
+			return *it;
+	}
+	return (nx.next == NULL) ? T() : C::value(nx.xnext, (Node *)nx.next);
+}
+
+// Do m searches at once, storing the answer for xs[j] in ans[j].  Every
+// search visits one node in each list, so we run them in groups of g in
+// lockstep.  Each step prefetches the NX that each search reads next, so
+// g cache misses overlap.  The learned model isn't used.
+template<class T, class C, class I, class E, class R>
+void TodoList4<T,C,I,E,R>::findBatch(T *xs, T *ans, size_t m, size_t g) {
+	if (g < 1) g = 1;
+	if (g > batch_max) g = batch_max;
+	if (frozen) {
+		findBatchFrozen(xs, ans, m, g);
+		return;
+	}
+	flush();
+	Node *u[batch_max];
+	Key kx[batch_max];
+	for (size_t j0 = 0; j0 < m; j0 += g) {
+		size_t k = min(g, m - j0);
+		for (size_t j = 0; j < k; j++) {
+			u[j] = sentinel;
+			kx[j] = C::key(xs[j0+j]);
+		}
+		for (int i = h; i >= 0; i--) {
+			for (size_t j = 0; j < k; j++) {
+				u[j] = step(u[j], i, kx[j], xs[j0+j]);
+				if (i > 0)
+					__builtin_prefetch(&u[j]->nx[i-1]);
+			}
+		}
+		for (size_t j = 0; j < k; j++) {
+			NX &nx = u[j]->nx[0];
+			if (nx.next != NULL && expired(nx.next)) {
+				Node *w = unexpired(nx.next);
+				ans[j0+j] = (w == NULL) ? T() : w->x;
+			} else {
+				ans[j0+j] = (nx.next == NULL) ? T() : C::value(nx.xnext, (Node *)nx.next);
+			}
+		}
+	}
+}
+
+// Fit the model to list model_level
+template<class T, class C, class I, class E, class R>
+void TodoList4<T,C,I,E,R>::train(std::true_type) {
+	model_level = h/2;
+	std::vector<T> keys;
+	model_nodes.clear();
+	for (Node *u = sentinel->nx[model_level].next; u != NULL;
+			u = u->nx[model_level].next) {
+		keys.push_back(u->x);
+		model_nodes.push_back(u);
+	}
+	model.train(keys.data(), keys.size());
+	model_fresh = true;
+	stale_finds = 0;
+	retrains++;
+}
+
+// Count a find() that couldn't use the model and, once there have been as
+// many as there are keys in its list, retrain it. Returns true if we did
+template<class T, class C, class I, class E, class R>
+bool TodoList4<T,C,I,E,R>::modelDue() {
+	if (++stale_finds < (size_t)n[h/2])
+		return false;
+	train(Learnable());
+	return true;
+}
+
+// Return the node holding the smallest value that is greater than or equal
+// to x, or NULL if there isn't one
+template<class T, class C, class I, class E, class R>
+typename TodoList4<T,C,I,E,R>::Node* TodoList4<T,C,I,E,R>::lowerBound(T x) {
 	Node *u = sentinel;
-	int i;
-	for (i = h; i >= 0; i--) {
-		if (u->nx[i].next != NULL && u->nx[i].xnext < x)
-			u = u->nx[i].next;
+	Key kx = C::key(x);
+	for (int i = h; i >= 0; i--)
+		u = step(u, i, kx, x);
+	return u->nx[0].next;
+}
+
+// Return the number of copies of x
+template<class T, class C, class I, class E, class R>
+size_t TodoList4<T,C,I,E,R>::count(T x) {
+	flush();
+	Node *w = lowerBound(x);
+	return (w != NULL && !expired(w) && w->x == x) ? w->count : 0;
+}
+
+// Remove the values that are greater than or equal to x and return a new
+// TodoList4 that holds them.  Each list is cut after the last node before
+// x, so the nodes stay where they are.  The new sizes of the lists come
+// from counting the shorter side of each cut, walking both sides at once,
+// so this takes O(log n + min(left, right)) time, plus whatever
+// rebalance() needs.  Our space is split in proportion to the keys, until
+// the next global rebuild recounts it.
+template<class T, class C, class I, class E, class R>
+TodoList4<T,C,I,E,R>* TodoList4<T,C,I,E,R>::split(T x) {
+	flush();
+	TodoList4<T,C,I,E,R> *t = new TodoList4<T,C,I,E,R>(eps);
+	arena.merge(t->arena); // t takes some of our nodes
+	t->space_factor = space_factor;
+	t->incremental = incremental;
+	t->multiset = multiset;
+	t->setLearned(learned);
+	t->setHeight(h);
+
+	Node *path[hmax+1];
+	Node *u = sentinel;
+	Key kx = C::key(x);
+	for (int i = h; i >= 0; i--) {
+		u = step(u, i, kx, x);
 		path[i] = u;
 	}
 
-	// abort if x is already here
-	Node *w = u->nx[0].next;
-	if (w != NULL && w->x == x)
+	int n0 = n[0];
+	for (int i = 0; i <= h; i++) {
+		t->sentinel->nx[i] = path[i]->nx[i];
+		path[i]->nx[i].next = NULL;
+		path[i]->nx[i].xnext = C::top();
+		Node *v = sentinel, *w = t->sentinel;
+		int c = 0;
+		int dv = 0, dw = 0;
+		while (v->nx[i].next != NULL && w->nx[i].next != NULL) {
+			v = v->nx[i].next;
+			w = w->nx[i].next;
+			dv += v->count - 1;
+			dw += w->count - 1;
+			c++;
+		}
+		if (v->nx[i].next == NULL) {
+			t->n[i] = n[i] - c;
+			n[i] = c;
+			if (i == 0) {
+				t->dups = dups - dv;
+				dups = dv;
+			}
+		} else {
+			t->n[i] = c;
+			n[i] -= c;
+			if (i == 0) {
+				t->dups = dw;
+				dups -= dw;
+			}
+		}
+	}
+	size_t moved = (space - slots(sentinel)) * t->n[0] / max(n0, 1);
+	space -= moved;
+	t->space += moved;
+
+	// the smaller side's entries move to the other side's hash index
+	t->hashed = hashed;
+	if (hashed && t->n[0] <= n[0]) {
+		shiftIndex(*t, t->sentinel->nx[0].next);
+	} else if (hashed) {
+		hash_index.swap(t->hash_index);
+		t->shiftIndex(*this, sentinel->nx[0].next);
+	}
+
+	// expiry times go with their values, which takes a pass over expiry
+	t->now = now;
+	expiry.split(x, t->expiry);
+
+	// some of the nodes in our current block might now be t's
+	retireBlock();
+	compacting = resuming = false;
+	tails_valid = model_fresh = false;
+	rebalance();
+	t->rebalance();
+	return t;
+}
+
+// Move all of t's values into this list.  Our values must all be smaller
+// than t's or all larger.  Call the list that goes first A and the other
+// B.  If we just extended A's lists with B's, a search could meet two
+// nodes of list i between consecutive nodes of list i+1 at the seam (A's
+// last and B's first), so first B's first node is promoted into every
+// list.  Then all it takes is the last node in each of A's lists, and
+// rebalance() fixes the sizes.  t is left empty.
+template<class T, class C, class I, class E, class R>
+void TodoList4<T,C,I,E,R>::join(TodoList4<T,C,I,E,R> &t) {
+	flush();
+	t.flush();
+	if (t.n[0] == 0) return;
+	arena.merge(t.arena); // we take t's nodes
+	int n0 = n[0] + t.n[0];
+	int h1 = max(max(h, t.h), (int)max(0.0, ceil(log(n0) / log(2-eps))));
+	setHeight(h1);
+	t.setHeight(h1);
+
+	bool before = n[0] > 0
+			&& t.sentinel->nx[0].next->x < sentinel->nx[0].next->x;
+	TodoList4<T,C,I,E,R> &A = before ? t : *this;
+	TodoList4<T,C,I,E,R> &B = before ? *this : t;
+	Node *last[hmax+1];
+	Node *u = A.sentinel;
+	for (int i = h1; i >= 0; i--) {
+		while (u->nx[i].next != NULL)
+			u = u->nx[i].next;
+		last[i] = u;
+	}
+
+	if (A.n[0] > 0) {
+		Node *b = B.sentinel->nx[0].next;
+		assert(last[0]->x < b->x);
+		Key kb = B.sentinel->nx[0].xnext;
+		Node *b1 = (slots(b) < (size_t)h1+1) ? B.resizeNode(b, h1) : b;
+		for (int i = 0; i <= h1; i++) {
+			if (B.sentinel->nx[i].next != b) {
+				b1->nx[i] = B.sentinel->nx[i];
+				B.n[i]++;
+			}
+			B.sentinel->nx[i].next = b1;
+			B.sentinel->nx[i].xnext = kb;
+		}
+	}
+
+	// take t's hash index, if it's the bigger one, or move t's entries
+	if (hashed && t.hashed && t.n[0] > n[0]) {
+		hash_index.swap(t.hash_index);
+		t.shiftIndex(*this, sentinel->nx[0].next);
+	} else if (hashed) {
+		t.shiftIndex(*this, t.sentinel->nx[0].next);
+	}
+	t.hash_index.clear();
+
+	now = max(now, t.now);
+	expiry.join(t.expiry);
+
+	for (int i = 0; i <= h1; i++) {
+		last[i]->nx[i] = B.sentinel->nx[i];
+		n[i] += t.n[i];
+		t.n[i] = 0;
+	}
+	if (before)
+		for (int i = 0; i <= h1; i++)
+			sentinel->nx[i] = t.sentinel->nx[i];
+	dups += t.dups;
+	t.dups = 0;
+	space += t.space - slots(t.sentinel);
+	t.space = slots(t.sentinel);
+	clearNX(t.sentinel->nx, slots(t.sentinel));
+
+	// each of us may have nodes in the other's current block
+	retireBlock();
+	t.retireBlock();
+	compacting = resuming = false;
+	t.compacting = t.resuming = false;
+	rebalance();
+	t.rebalance();
+}
+
+// Remove one copy of x, if there is one
+template<class T, class C, class I, class E, class R>
+bool TodoList4<T,C,I,E,R>::remove(T x) {
+	flush();
+	Node *before[hmax+1];
+	Node *w = searchPath(x, before);
+	if (w == NULL || !(w->x == x))
 		return false;
+	bool dead = expired(w);
+	if (w->count > 1 && !dead) {
+		w->count--;
+		dups--;
+		return true;
+	}
+	eraseNode(w, before);
+	return !dead;
+}
+
+// Search for x, storing its predecessor in list i in before[i], and
+// return the node holding the smallest value that is greater than or
+// equal to x, or NULL if there isn't one
+template<class T, class C, class I, class E, class R>
+typename TodoList4<T,C,I,E,R>::Node* TodoList4<T,C,I,E,R>::searchPath(T x,
+		Node **before) {
+	Node *u = sentinel;
+	Key kx = C::key(x);
+	for (int i = h; i >= 0; i--) {
+		u = step(u, i, kx, x);
+		before[i] = u;
+	}
+	return u->nx[0].next;
+}
+
+// Remove w, with all its copies, given its predecessors from searchPath()
+template<class T, class C, class I, class E, class R>
+size_t TodoList4<T,C,I,E,R>::eraseNode(Node *w, Node **before) {
+	Node *last[hmax+1];
+	for (int i = 0; i <= h; i++)
+		last[i] = (before[i]->nx[i].next == w) ? w : before[i];
+	return erase(before, last);
+}
+
+// Remove and return the smallest value, or return T() if we're empty.  The
+// minimum is first in every list it's in, so it comes out of those lists
+// without a search, and leaving the first gap of each list shorter can't
+// break anything.  Its expected height is O(1).  h is lowered lazily, by
+// a rebalance() once n[0] has fallen below a[h-2]
+template<class T, class C, class I, class E, class R>
+T TodoList4<T,C,I,E,R>::deleteMin() {
+	flush();
+	for (;;) {
+		Node *m = sentinel->nx[0].next;
+		if (m == NULL)
+			return T();
+		T x = m->x;
+		bool dead = expired(m); // if so, drop it and try again
+		if (m->count > 1 && !dead) {
+			m->count--;
+			dups--;
+			return x;
+		}
+		dups -= m->count - 1;
+		int i;
+		for (i = 0; i <= h && sentinel->nx[i].next == m; i++) {
+			sentinel->nx[i] = m->nx[i];
+			n[i]--;
+			if (tail[i] == m)
+				tail[i] = sentinel;
+		}
+		if (i > model_level)
+			model_fresh = false;
+		drop(m);
+		if (h >= 2 && n[0] < a[h-2])
+			rebalance();
+		if (!dead)
+			return x;
+	}
+}
 
-	// insert x everywhere along the search path
-	w = newNode(h);
+// Remove every value v with lo <= v < hi, and return how many there were,
+// not counting those that have expired
+template<class T, class C, class I, class E, class R>
+size_t TodoList4<T,C,I,E,R>::eraseRange(T lo, T hi) {
+	flush();
+	if (!(lo < hi)) return 0;
+	Node *before[hmax+1], *last[hmax+1];
+	Node *u = sentinel, *w = sentinel;
+	Key klo = C::key(lo), khi = C::key(hi);
+	for (int i = h; i >= 0; i--) {
+		u = step(u, i, klo, lo);
+		w = step(w, i, khi, hi);
+		before[i] = u;
+		last[i] = w;
+	}
+	return (u == w) ? 0 : erase(before, last);
+}
+
+// Remove the nodes after before[i], up to and including last[i], from each
+// list i, free them, and return the number of unexpired values they held.  Each
+// list is unlinked in one step, and only counting and freeing the nodes
+// takes time proportional to their number.  Where the gap closes, a
+// search could now meet two nodes of list i between consecutive nodes of
+// list i+1, but only in lists 0,...,k, where k is the highest list the
+// removed nodes were in, so the first node after the gap is promoted
+// into those lists, as in join().  Then rebalance() does at most one
+// rebuild(i)
+template<class T, class C, class I, class E, class R>
+size_t TodoList4<T,C,I,E,R>::erase(Node **before, Node **last) {
+	size_t erased = unlink(before, last);
+	rebalance();
+	return erased;
+}
+
+// Do erase(before, last), but leave the list sizes for rebalance()
+template<class T, class C, class I, class E, class R>
+size_t TodoList4<T,C,I,E,R>::unlink(Node **before, Node **last) {
+	int k = 0, top = h;
+	for (int i = 0; i <= top; i++) {
+		for (Node *v = before[i]; v != last[i]; v = v->nx[i].next) {
+			n[i]--;
+			k = i;
+		}
+	}
+	Node *v = before[0]->nx[0].next;
+	for (int i = 0; i <= k; i++)
+		before[i]->nx[i] = last[i]->nx[i];
+	size_t erased = 0;
+	Node *end = before[0]->nx[0].next;
+	while (v != end) {
+		Node *next = v->nx[0].next;
+		if (!expired(v))
+			erased += v->count;
+		dups -= v->count - 1;
+		drop(v);
+		v = next;
+	}
+
+	Node *b = before[0]->nx[0].next;
+	if (b != NULL) {
+		Key kb = before[0]->nx[0].xnext;
+		Node *b1 = (slots(b) < (size_t)k+1) ? resizeNode(b, k) : b;
+		for (int i = 0; i <= k; i++) {
+			if (before[i]->nx[i].next != b) {
+				b1->nx[i] = before[i]->nx[i];
+				n[i]++;
+			}
+			before[i]->nx[i].next = b1;
+			before[i]->nx[i].xnext = kb;
+		}
+	}
+	for (int i = 0; i <= k; i++) {
+		Node *u = before[i]->nx[i].next;
+		if (u == NULL)
+			tail[i] = before[i];
+		else if (u->nx[i].next == NULL)
+			tail[i] = u;
+	}
+	if (k >= model_level)
+		model_fresh = false;
+	return erased;
+}
+
+// Change the number of lists to h1+1.  New lists are empty, and lists
+// above h1 are forgotten
+template<class T, class C, class I, class E, class R>
+void TodoList4<T,C,I,E,R>::setHeight(int h1) {
+	if (h1 > h) {
+		if (slots(sentinel) < (size_t)h1+1)
+			sentinel = resizeNode(sentinel, h1);
+		clearNX(sentinel->nx + h+1, h1 - h);
+	}
+	int *n1 = new int[h1+1]();
+	std::copy(n, n + min(h, h1) + 1, n1);
+	delete[] n;
+	n = n1;
+	h = h1;
+	model_fresh = false;
+	tails_valid = false;
+}
+
+// Give ourselves the height n[0] values should have, and rebuild the
+// lists above the last one that is within its size bound
+template<class T, class C, class I, class E, class R>
+void TodoList4<T,C,I,E,R>::rebalance() {
+	int h1 = max(0.0, ceil(log(n[0]) / log(2-eps)));
+	if (h1 != h)
+		setHeight(h1);
+	int i = 0;
+	while (i < h && n[i+1] <= a[h-i-1])
+		i++;
+	if (i < h)
+		rebuild(i);
+}
+
+// Store the smallest value that is greater than or equal to x in y and
+// return true, or return false if there isn't one
+template<class T, class C, class I, class E, class R>
+bool TodoList4<T,C,I,E,R>::successor(T x, T &y) {
+	flush();
+	Node *w = unexpired(lowerBound(x));
+	if (w == NULL)
+		return false;
+	y = w->x;
+	return true;
+}
+
+// Is x here?  With a hash index this takes O(1) expected time
+template<class T, class C, class I, class E, class R>
+bool TodoList4<T,C,I,E,R>::contains(T x) {
+	flush();
+	Node *w = hashed ? hash_index.get(x) : lowerBound(x);
+	return w != NULL && !expired(w) && w->x == x;
+}
+
+// Store the value here that is equal to x in y and return true, or return
+// false if there isn't one
+template<class T, class C, class I, class E, class R>
+bool TodoList4<T,C,I,E,R>::findExact(T x, T &y) {
+	flush();
+	Node *w = hashed ? hash_index.get(x) : lowerBound(x);
+	if (w == NULL || expired(w) || !(w->x == x))
+		return false;
+	y = w->x;
+	return true;
+}
+
+// Turn the hash index on, indexing every node, or off, freeing it
+template<class T, class C, class I, class E, class R>
+void TodoList4<T,C,I,E,R>::setHashIndex(bool b) {
+	flush();
+	hashed = b && I::enabled;
+	hash_index.clear();
+	if (hashed)
+		for (Node *u = sentinel->nx[0].next; u != NULL; u = u->nx[0].next)
+			hash_index.add(u->x, u);
+}
+
+// Move the entries of u and the nodes after it in list 0 from our hash
+// index to t's
+template<class T, class C, class I, class E, class R>
+void TodoList4<T,C,I,E,R>::shiftIndex(TodoList4<T,C,I,E,R> &t, Node *u) {
+	for (; u != NULL; u = u->nx[0].next) {
+		hash_index.erase(u->x);
+		t.hash_index.add(u->x, u);
+	}
+}
+
+// Make u's value expire at *t or, if t is NULL, never
+template<class T, class C, class I, class E, class R>
+void TodoList4<T,C,I,E,R>::stamp(Node *u, const Time *t) {
+	if (t != NULL) {
+		u->type |= has_expiry;
+		expiry.set(u->x, *t);
+	} else if (u->type & has_expiry) {
+		u->type &= ~has_expiry;
+		expiry.erase(u->x);
+	}
+}
+
+// Forget u, which is in no list now, and free it
+template<class T, class C, class I, class E, class R>
+void TodoList4<T,C,I,E,R>::drop(Node *u) {
+	if (hashed)
+		hash_index.erase(u->x);
+	if (u->type & has_expiry)
+		expiry.erase(u->x);
+	deleteNode(u);
+}
+
+// Make it time t, and remove values that expired at or before t.  The
+// first work deadlines, in order of expiry, are taken from expiry and
+// their values sorted.  Then one pass from left to right unlinks their
+// nodes, each search starting from the last one's path, as in flush(),
+// and a single rebalance() follows.  Return the number of values removed
+template<class T, class C, class I, class E, class R>
+size_t TodoList4<T,C,I,E,R>::purgeExpired(Time t, size_t work) {
+	flush();
+	now = max(now, t);
+	std::vector<T> xs;
+	T x;
+	for (size_t k = 0; k < work && expiry.due(now); k++)
+		if (expiry.pop(x))
+			xs.push_back(x);
+	if (xs.empty())
+		return 0;
+	std::sort(xs.begin(), xs.end());
+	xs.erase(std::unique(xs.begin(), xs.end()), xs.end());
+
+	size_t purged = 0;
+	Node *path[hmax+1], *last[hmax+1];
+	for (int i = 0; i <= h; i++)
+		path[i] = sentinel;
+	for (size_t j = 0; j < xs.size(); j++) {
+		Key kx = C::key(xs[j]);
+		int i = 0;
+		while (i < h && step(path[i], i, kx, xs[j]) != path[i])
+			i++;
+		Node *u = path[i];
+		for (; i >= 0; i--) {
+			u = step(u, i, kx, xs[j]);
+			path[i] = u;
+		}
+		Node *w = u->nx[0].next;
+		assert(w != NULL && w->x == xs[j]);
+		purged += w->count;
+		for (i = 0; i <= h; i++)
+			last[i] = (path[i]->nx[i].next == w) ? w : path[i];
+		unlink(path, last);
+	}
+	rebalance();
+	return purged;
+}
+
+// Write our values to out in sorted order, once each even in multiset
+// mode, and return the end of what was written
+template<class T, class C, class I, class E, class R> template<class Out>
+Out TodoList4<T,C,I,E,R>::copyTo(Out out) {
+	flush();
+	for (Node *u = unexpired(sentinel->nx[0].next); u != NULL;
+			u = unexpired(u->nx[0].next))
+		*out++ = u->x;
+	return out;
+}
+
+// Return the smallest value that is greater than or equal to x and the
+// smallest value that is greater than x. Like find(x), either of these is
+// T() if there is no such value
+template<class T, class C, class I, class E, class R>
+std::pair<T,T> TodoList4<T,C,I,E,R>::equalRange(T x) {
+	flush();
+	Node *w = unexpired(lowerBound(x));
+	if (w == NULL)
+		return std::pair<T,T>(T(), T());
+	if (!(w->x == x))
+		return std::pair<T,T>(w->x, w->x);
+	Node *v = unexpired(w->nx[0].next);
+	return std::pair<T,T>(w->x, (v == NULL) ? T() : v->x);
+}
+
+template<class T, class C, class I, class E, class R>
+bool TodoList4<T,C,I,E,R>::add(T x) {
+	if (frozen)
+		thaw();
+	if (buffer_max > 0)
+		return addBuffered(x);
+	return insert(x, NULL);
+}
+
+// Add x, or count it, as add(x) does, and make it expire at time t.  If x
+// is already here then it expires at t instead of when it did.  Values
+// that expire don't go into the insert buffer
+template<class T, class C, class I, class E, class R>
+bool TodoList4<T,C,I,E,R>::add(T x, Time t) {
+	static_assert(E::enabled, "only a Timed TodoList4 has values that expire");
+	flush();
+	return insert(x, &t);
+}
+
+// Do add(x), and if t isn't NULL then make x expire at *t
+template<class T, class C, class I, class E, class R>
+bool TodoList4<T,C,I,E,R>::insert(T x, const Time *t) {
+	// search for x and keep track of the search path, unless x is bigger
+	// than everything here, in which case the path is the tails.  Then x
+	// can go into lists 0,...,height without any rebuilding if, after the
+	// last node of list height+1, there's no node of list height yet.  The
+	// lowest such list makes appended values' heights count like a binary
+	// counter, as in rebuild(0)
+	Node *path[hmax+1];
+	Node *u = sentinel;
+	Key kx = C::key(x);
+	int i, height = h;
+	bool appending = append && (tails_valid || findTails())
+			&& tail[0] != sentinel && tail[0]->x < x;
+	if (appending) {
+		for (i = h; i >= 0; i--)
+			path[i] = tail[i];
+		u = tail[0];
+		for (height = 0; height < h && tail[height] != tail[height+1]; height++);
+	} else {
+		for (i = h; i >= 0; i--) {
+			u = step(u, i, kx, x);
+			path[i] = u;
+		}
+	}
+
+	// abort if x is already here, or just count it in multiset mode.  If
+	// x has expired then it's back, with no copies
+	Node *w = u->nx[0].next;
+	if (w != NULL && w->x == x) {
+		bool dead = expired(w);
+		if (dead) {
+			dups -= w->count - 1;
+			w->count = 1;
+		}
+		if (dead || t != NULL)
+			stamp(w, t);
+		if (dead)
+			return true;
+		if (!multiset)
+			return false;
+		if (!countCopy(w))
+			throw std::length_error("TodoList4::add(): too many copies");
+		return true;
+	}
+
+	// figure out which lists x has to go into. If adding x to every list
+	// would make lists top+1,...,h too big, then they are about to be
+	// rebuilt from list top, so x only goes into lists 0,...,top and
+	// rebuild(top) will promote it if needed
+	bool global = (n[0]+1 > a[h]);
+	int top = h;
+	if (global) {
+		top = 0;
+	} else if (n[h]+1 > 1) {
+		for (top = h-1; n[top]+1 > a[h-top]; top--);
+		assert(top >= 0);
+	}
+	bool settled = !global && height < top;
+	if (settled)
+		top = height;
+
+	// insert x into lists 0,...,top, and appended nodes in allocation order
+	w = appending ? newBulkNode(top) : newNode(top);
 	w->x = x;
-	for (i = h; i >= 0; i--) {
+	if (hashed)
+		hash_index.add(w->x, w);
+	if (t != NULL)
+		stamp(w, t);
+	for (i = top; i >= 0; i--) {
 		w->nx[i] = path[i]->nx[i];
 		path[i]->nx[i].next = w;
-		path[i]->nx[i].xnext = x;
+		path[i]->nx[i].xnext = kx;
 		n[i]++;
+		if (w->nx[i].next == NULL)
+			tail[i] = w;
 	}
+	if (top >= model_level)
+		model_fresh = false;
 
-	// check if we need to add another level on the bottom
-	if (n[0] > a[h])
+	if (global) {
+		// we need to add another level on the bottom
+		size_rebuilds++;
 		rebuild();
+	} else if (space > (incremental ? 2 : 1)*space_factor*n[0]) {
+		// we need to rebuild because space is too high
+		space_rebuilds++;
+		rebuild();
+	} else if (top < h && !settled) {
+		// there were too many nodes in the top level
+		rebuild(top);
+	}
 
-	// check if we need to rebuild because space is too high
-	if (space > space_factor*n[0])
+	// shrink some oversized nodes if space is too high
+	if (incremental && space > space_factor*n[0])
+		compacting = true;
+	if (compacting)
+		compact();
+	return true;
+}
+
+// Add x to the insert buffer, unless it's already there and we're not in
+// multiset mode, in which case the buffer may hold several copies of a
+// value.  The lists aren't searched, so this returns true for an x that
+// is only in the lists, and flush() sorts it out
+template<class T, class C, class I, class E, class R>
+bool TodoList4<T,C,I,E,R>::addBuffered(T x) {
+	typename std::vector<T>::iterator it
+			= std::lower_bound(buffer.begin(), buffer.end(), x);
+	if (!multiset && it != buffer.end() && *it == x)
+		return false;
+	if (!multiset) {
+		Node *w = hashed ? hash_index.get(x) : lowerBound(x);
+		if (w != NULL && w->x == x && !expired(w))
+			return false;
+	}
+	buffer.insert(it, x);
+	if (buffer.size() >= buffer_max)
+		flush();
+	return true;
+}
+
+// A buffered value was found in w.  Count it in multiset mode, or bring
+// it back if it had expired, for good; otherwise it's dropped.  Return
+// false if it was a copy too many
+template<class T, class C, class I, class E, class R>
+bool TodoList4<T,C,I,E,R>::addCopy(Node *w) {
+	if (expired(w)) {
+		dups -= w->count - 1;
+		w->count = 1;
+		stamp(w, NULL);
+	} else if (multiset) {
+		return countCopy(w);
+	}
+	return true;
+}
+
+// Move the insert buffer into the lists.  If every buffered value can go
+// into lists 0,...,top without making them too big, then each one does,
+// as in add(), and a single rebuild(top) follows.  Searches meanwhile
+// can't take one step per list in list top, whose gaps between nodes of
+// list top+1 are growing, so they walk it.  Otherwise the buffer is merged
+// into list 0 and everything above it is rebuilt.  Copies of a value
+// beyond max_count are dropped, and we throw once the lists are whole.
+template<class T, class C, class I, class E, class R>
+void TodoList4<T,C,I,E,R>::flush() {
+	if (frozen)
+		thaw();
+	if (buffer.empty()) return;
+	tails_valid = false;
+	size_t b = buffer.size();
+	int top = h;
+	if (n[0] + b > (size_t)a[h]) {
+		top = -1;
+	} else if (n[h] + b > 1) {
+		for (top = h-1; top >= 0 && n[top] + b > (size_t)a[h-top]; top--);
+	}
+	bool whole = true; // no copies were dropped
+	if (top < 0 || b * h >= (size_t)n[0]) {
+		whole = mergeBuffer();
+	} else {
+		Node *path[hmax+1];
+		for (int i = 0; i <= h; i++)
+			path[i] = sentinel;
+		Node *held = NULL; // the node of the last value
+		for (size_t j = 0; j < b; j++) {
+			T &x = buffer[j];
+			if (j > 0 && x == buffer[j-1]) { // a copy, in multiset mode
+				whole &= countCopy(held);
+				continue;
+			}
+			Key kx = C::key(x);
+			// the values are sorted, so x's search starts from the lowest
+			// list where the last one's search path is still x's
+			int i = 0;
+			while (i < h && step(path[i], i, kx, x) != path[i])
+				i++;
+			Node *u = path[i];
+			for (; i >= 0; i--) {
+				u = step(u, i, kx, x);
+				for (Node *v; i == top && (v = step(u, i, kx, x)) != u; u = v);
+				path[i] = u;
+			}
+			Node *w = path[0]->nx[0].next;
+			if (w != NULL && w->x == x) {
+				held = w;
+				whole &= addCopy(w);
+				continue;
+			}
+			w = held = newNode(top);
+			w->x = x;
+			if (hashed)
+				hash_index.add(w->x, w);
+			for (int i = top; i >= 0; i--) {
+				w->nx[i] = path[i]->nx[i];
+				path[i]->nx[i].next = w;
+				path[i]->nx[i].xnext = kx;
+				path[i] = w;
+				n[i]++;
+			}
+		}
+		buffer.clear();
+		model_fresh = false;
+		if (top < h)
+			rebuild(top);
+	}
+
+	if (space > (incremental ? 2 : 1)*space_factor*n[0]) {
+		space_rebuilds++;
 		rebuild();
+	}
+	if (incremental && space > space_factor*n[0])
+		compacting = true;
+	if (compacting)
+		compact();
+	if (!whole)
+		throw std::length_error("TodoList4::flush(): too many copies");
+}
 
-	// check if we need rebuilding because too many nodes in top level
-	if (n[h] > 1) {
-		for (i = h-1; n[i] > a[h-i]; i--);
-		assert(i <= h);
-		rebuild(i);
+// Merge the insert buffer into list 0, in one pass, and then rebuild the
+// other lists, or everything if there are now too many values for h.
+// Return false if any copies were dropped
+template<class T, class C, class I, class E, class R>
+bool TodoList4<T,C,I,E,R>::mergeBuffer() {
+	bool whole = true;
+	Node *u = sentinel;
+	for (size_t j = 0; j < buffer.size(); j++) {
+		T &x = buffer[j];
+		Key kx = C::key(x);
+		for (Node *v; (v = step(u, 0, kx, x)) != u; u = v);
+		Node *w = u->nx[0].next;
+		if (w != NULL && w->x == x) {
+			whole &= addCopy(w);
+			continue;
+		}
+		w = newNode(0);
+		w->x = x;
+		if (hashed)
+			hash_index.add(w->x, w);
+		w->nx[0] = u->nx[0];
+		u->nx[0].next = w;
+		u->nx[0].xnext = kx;
+		n[0]++;
+	}
+	buffer.clear();
+	if (n[0] > a[h]) {
+		size_rebuilds++;
+		rebuild();
+	} else {
+		model_fresh = false;
+		rebuild(0);
+	}
+	return whole;
+}
+
+// Find the last node of each list, which takes one step per list, and
+// return true
+template<class T, class C, class I, class E, class R>
+bool TodoList4<T,C,I,E,R>::findTails() {
+	Node *u = sentinel;
+	for (int i = h; i >= 0; i--) {
+		while (u->nx[i].next != NULL)
+			u = u->nx[i].next;
+		tail[i] = u;
 	}
+	tails_valid = true;
 	return true;
 }
 
-template<class T>
-TodoList4<T>::~TodoList4() {
-	delete[] n;
+template<class T, class C, class I, class E, class R>
+TodoList4<T,C,I,E,R>::~TodoList4() {
 	delete[] a;
+	destroy();
+	clearFrozen();
+}
+
+// Pack the nodes into one array, in two passes over list 0, and free them.
+// find(), findBatch() and size() work on the array; anything else thaws it
+// first.  Values that have expired are purged first and, since time only
+// moves on in operations that thaw, no packed value expires while we're
+// frozen.  The has_expiry bits are dropped, since expiry still says which
+// values expire.  The hash index and learned model are dropped too, and
+// rebuilt by thaw() or the next find() that wants the model.  If the array
+// would be too big for 32-bit offsets this throws std::length_error, and
+// if it can't be allocated std::bad_alloc, before anything is packed.
+template<class T, class C, class I, class E, class R>
+void TodoList4<T,C,I,E,R>::freeze() {
+	flush();
+	purgeExpired(now);
+
+	// find each node's height
+	std::vector<unsigned char> top(n[0]);
+	Node *cur[hmax+1]; // the next node of each list
+	for (int i = 0; i <= h; i++)
+		cur[i] = sentinel->nx[i].next;
+	size_t r = 0;
+	for (Node *u = sentinel->nx[0].next; u != NULL; u = u->nx[0].next) {
+		int i;
+		for (i = 0; i <= h && cur[i] == u; i++)
+			cur[i] = u->nx[i].next;
+		top[r++] = i - 1;
+	}
+
+	// the sentinel, then the nodes of height h, h-1, ..., 0 in sorted order
+	size_t next[hmax+1]; // where the next node of each height goes
+	size_t total = funits(h);
+	for (int t = h; t >= 0; t--) {
+		next[t] = total;
+		total += (n[t] - (t < h ? n[t+1] : 0)) * funits(t);
+	}
+	if (total > UINT32_MAX)
+		throw std::length_error("TodoList4::freeze(): too many nodes");
+	packed = (char *) malloc(total * alignof(FNode));
+	if (packed == NULL)
+		throw std::bad_alloc();
+	packed_units = total;
+	Ref prev[hmax+1];
+	for (int i = 0; i <= h; i++) {
+		fat(0)->nx[i].k = C::top();
+		fat(0)->nx[i].next = 0;
+		prev[i] = 0;
+	}
+	if (dups > 0)
+		counts.resize(n[0]);
+	r = 0;
+	for (Node *u = sentinel->nx[0].next; u != NULL; u = u->nx[0].next, r++) {
+		Ref f = next[top[r]];
+		next[top[r]] += funits(top[r]);
+		FNode *v = fat(f);
+		new (&v->x) T(std::move(u->x));
+		Key k = C::key(v->x);
+		for (int i = 0; i <= top[r]; i++) {
+			v->nx[i].k = C::top();
+			v->nx[i].next = 0;
+			fat(prev[i])->nx[i].k = k;
+			fat(prev[i])->nx[i].next = f;
+			prev[i] = f;
+		}
+		if (dups > 0)
+			counts[r] = u->count;
+	}
+
+	// free the nodes, but keep n
+	int *n1 = n;
+	n = NULL;
+	destroy();
+	n = n1;
+	sentinel = NULL;
+	space = 0;
+	hash_index.clear();
+	tails_valid = false;
+	model_fresh = false;
+	compacting = resuming = false;
+	frozen = true;
+}
+
+// Turn the frozen array back into lists, with every node at the height it
+// had when we froze
+template<class T, class C, class I, class E, class R>
+void TodoList4<T,C,I,E,R>::thaw() {
+	if (!frozen) return;
+	sentinel = newNode(h);
+	Node *prev[hmax+1];
+	Ref cur[hmax+1];
+	for (int i = 0; i <= h; i++) {
+		prev[i] = sentinel;
+		cur[i] = fat(0)->nx[i].next;
+	}
+	size_t r = 0;
+	for (Ref f = fat(0)->nx[0].next; f != 0; f = fat(f)->nx[0].next, r++) {
+		FNode *v = fat(f);
+		int t;
+		for (t = 0; t <= h && cur[t] == f; t++)
+			cur[t] = v->nx[t].next;
+		Node *u = newBulkNode(t-1);
+		u->x = std::move(v->x);
+		if (!counts.empty())
+			u->count = counts[r];
+		if (expiry.contains(u->x))
+			u->type |= has_expiry;
+		Key k = C::key(u->x);
+		for (int i = 0; i < t; i++) {
+			prev[i]->nx[i].next = u;
+			prev[i]->nx[i].xnext = k;
+			prev[i] = u;
+		}
+	}
+	clearFrozen();
+	if (hashed)
+		setHashIndex(true);
+}
+
+// Free the frozen array, if there is one
+template<class T, class C, class I, class E, class R>
+void TodoList4<T,C,I,E,R>::clearFrozen() {
+	if (!frozen) return;
+	for (Ref f = fat(0)->nx[0].next; f != 0; f = fat(f)->nx[0].next)
+		fat(f)->x.~T();
+	free(packed);
+	packed = NULL;
+	packed_units = 0;
+	std::vector<unsigned>().swap(counts);
+	frozen = false;
+}
+
+// find() on the frozen array
+template<class T, class C, class I, class E, class R>
+T TodoList4<T,C,I,E,R>::findFrozen(T x) {
+	Key kx = C::key(x);
+	Ref u = 0;
+	for (int i = h; i >= 0; i--) {
+		FNX &nx = fat(u)->nx[i];
+		if (biased && nx.next != 0 && C::equal(nx.k, kx, fat(nx.next), x))
+			return C::value(nx.k, fat(nx.next));
+		u = fstep(u, i, kx, x);
+	}
+	FNX &nx = fat(u)->nx[0];
+	return (nx.next == 0) ? T() : C::value(nx.k, fat(nx.next));
+}
+
+// findBatch() on the frozen array
+template<class T, class C, class I, class E, class R>
+void TodoList4<T,C,I,E,R>::findBatchFrozen(T *xs, T *ans, size_t m, size_t g) {
+	Ref u[batch_max];
+	Key kx[batch_max];
+	for (size_t j0 = 0; j0 < m; j0 += g) {
+		size_t k = min(g, m - j0);
+		for (size_t j = 0; j < k; j++) {
+			u[j] = 0;
+			kx[j] = C::key(xs[j0+j]);
+		}
+		for (int i = h; i >= 0; i--) {
+			for (size_t j = 0; j < k; j++) {
+				u[j] = fstep(u[j], i, kx[j], xs[j0+j]);
+				if (i > 0)
+					__builtin_prefetch(&fat(u[j])->nx[i-1]);
+			}
+		}
+		for (size_t j = 0; j < k; j++) {
+			FNX &nx = fat(u[j])->nx[0];
+			ans[j0+j] = (nx.next == 0) ? T() : C::value(nx.k, fat(nx.next));
+		}
+	}
+}
+
+// Free all our nodes and blocks
+template<class T, class C, class I, class E, class R>
+void TodoList4<T,C,I,E,R>::destroy() {
+	delete[] n;
 	Node *prev = sentinel;
 	while (prev != NULL) {
 		Node *u = prev->nx[0].next;
@@ -259,10 +2046,11 @@ TodoList4<T>::~TodoList4() {
 		deleteNode(prev);
 		prev = u;
 	}
+	retireBlock();
 }
 
-template<class T>
-void TodoList4<T>::sanity() {
+template<class T, class C, class I, class E, class R>
+void TodoList4<T,C,I,E,R>::sanity() {
 	assert(n[0] <= 1);
 	for (int i = 0; i <= h; i++) {
 		Node *u = sentinel;
@@ -274,8 +2062,9 @@ void TodoList4<T>::sanity() {
 	}
 }
 
-template<class T>
-void TodoList4<T>::printOn(std::ostream &out) {
+template<class T, class C, class I, class E, class R>
+void TodoList4<T,C,I,E,R>::printOn(std::ostream &out) {
+	flush();
 	const int max_print = 50;
 	out << "WSSkiplist: n = " << n[h] << ", k = " << h << endl;
 	for (int i = h; i >= 0; i--) {
@@ -292,8 +2081,33 @@ void TodoList4<T>::printOn(std::ostream &out) {
 	}
 }
 
-template<class T>
-ostream& operator<<(ostream &out, TodoList4<T> &sl) {
+template<class T, class C, class I, class E, class R>
+void TodoList4<T,C,I,E,R>::printStats(std::ostream &out) {
+	out << "I: " << size_rebuilds << " global rebuilds for size, "
+			<< space_rebuilds << " for space, "
+			<< compactions << " nodes compacted, "
+			<< (double)space / max(n[0], 1) << " NX slots per key" << endl;
+	if (hashed)
+		out << "I: hash index holds " << hash_index.size() << " keys in "
+				<< hash_index.bytes() << " bytes, "
+				<< (double)hash_index.bytes() / max(n[0], 1) << " per key"
+				<< endl;
+	if (frozen)
+		out << "I: frozen into " << packed_units * alignof(FNode) << " bytes, "
+				<< (double)packed_units * alignof(FNode) / max(n[0], 1)
+				<< " per key" << endl;
+	if (!expiry.empty())
+		out << "I: " << expiry.size() << " values expire, "
+				<< expiry.queued() << " deadlines queued, time is " << now
+				<< endl;
+	if (learned)
+		out << "I: learned model of list " << model_level << " of " << h
+				<< " has " << model.segments() << " segments, trained "
+				<< retrains << " times" << endl;
+}
+
+template<class T, class C, class I, class E, class R>
+ostream& operator<<(ostream &out, TodoList4<T,C,I,E,R> &sl) {
 	sl.printOn(out);
 	return out;
 }
@@ -0,0 +1,476 @@
+/**
+ * (c) 2014 Pat Morin, Released under a CC BY 3.0 License:
+ *     https://creativecommons.org/licenses/by/3.0/
+ *
+ * TodoListBase.h : A top-down skiplist, assembled from policies
+ *
+ * The todolist versions differ in three independent choices, each of which
+ * is a policy class chosen at compile time:
+ *
+ * - Layout: what a node stores with each next pointer.  PlainLayout stores
+ *   just the pointer, like Pugh's skiplists.  NXLayout also stores
+ *   KeyCache<T>::Key for the key it points to (the whole key, or the
+ *   prefix of a string; see KeyCache.h), so a search reads one node per
+ *   level instead of two.  PrefetchNXLayout does the same and prefetches
+ *   the node a search might move to before it does the comparison.
+ * - Rebuild: how lists i+1,...,h are rebuilt from list i.  HalvingRebuild
+ *   makes one pass per list, keeping every other node of the list below.
+ *   CountingRebuild makes a single pass over list i, putting its q'th node
+ *   in lists i,...,i+ctz(q).
+ * - Alloc: how big nodes are.  FullHeightAlloc gives every node room for
+ *   all h+1 lists.  SizeClassAlloc uses TodoList4's size classes: it
+ *   rounds a node's height up to a power of 2, resizes it when it is
+ *   promoted, and rebuilds everything when the total space gets too
+ *   large, so it uses linear space.
+ *
+ * TodoList, TodoList2 and TodoList3 are instances of TodoListBase.
+ * TodoList4 is NXLayout and CountingRebuild with linear-space nodes, but
+ * its nodes are carved from blocks, compacted, counted, marked as
+ * expiring and moved under a hash index, and its rebuilds also keep its
+ * tails and learned model, so it has its own implementation.
+ *
+ * Lists are numbered 0,...,h from the bottom up, so list 0 has everything.
+ */
+#ifndef FASTWS_TODOLISTBASE_H_
+#define FASTWS_TODOLISTBASE_H_
+
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <climits>
+#include <cassert>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <stdint.h>
+
+#include <iostream>
+using namespace std;
+
+#include "KeyCache.h"
+
+namespace todolist {
+
+// A next pointer on its own.  Searches compute key(x) once and then ask
+// each slot whether the key it points to is less than x
+template<class T, class Node>
+struct PlainSlot {
+	typedef char Key;
+	Node *next;
+	static inline Key key(T &x) { return 0; }
+	inline bool less(Key k, T &x) { return next->x < x; }
+	inline T value() { return next->x; }
+	inline void set(Node *u) { next = u; }
+	inline void clear() { next = NULL; }
+	inline void prefetch(int i) { }
+};
+
+// A next pointer along with C::Key of the key it points to
+template<class T, class Node, class C = KeyCache<T> >
+struct NXSlot {
+	typedef typename C::Key Key;
+	Node *next;
+	Key xnext;
+	static inline Key key(T &x) { return C::key(x); }
+	inline bool less(Key k, T &x) { return C::less(xnext, k, next, x); }
+	inline T value() { return C::value(xnext, next); }
+	inline void set(Node *u) { next = u; xnext = C::key(u->x); }
+	inline void clear() { next = NULL; xnext = C::top(); }
+	inline void prefetch(int i) { }
+};
+
+// An NXSlot that, on list i, prefetches the part of next that the search
+// reads on list i-1.  The address is computed as an integer since next may
+// be NULL, and prefetching it is harmless.
+template<class T, class Node, class C = KeyCache<T> >
+struct PrefetchNXSlot : public NXSlot<T, Node, C> {
+	inline void prefetch(int i) {
+		__builtin_prefetch((void *)((uintptr_t)this->next + sizeof(Node)
+				+ (i > 0 ? i-1 : 0) * sizeof(*this)));
+	}
+};
+
+struct PlainLayout {
+	template<class T, class Node> using Slot = PlainSlot<T, Node>;
+};
+
+struct NXLayout {
+	template<class T, class Node> using Slot = NXSlot<T, Node>;
+};
+
+struct PrefetchNXLayout {
+	template<class T, class Node> using Slot = PrefetchNXSlot<T, Node>;
+};
+
+// Rebuild one list at a time, each from the one below it
+struct HalvingRebuild {
+	template<class L>
+	static void rebuild(L &l, int i) {
+		typedef typename L::Node Node;
+		for (int j = i + 1; j <= l.h; j++) {
+			// populate L_j using L_{j-1}
+			l.n[j] = 0;
+			Node *prev = l.sentinel;
+			Node *w = l.sentinel;
+			bool skipped = false;
+			while (w->nx[j-1].next != NULL) {
+				Node *u = w->nx[j-1].next;
+				if (skipped) {
+					u = l.promote(w, j-1, j);
+					prev->nx[j].set(u);
+					prev = u;
+					l.n[j]++;
+				}
+				skipped = !skipped;
+				w = u;
+			}
+			prev->nx[j].clear();
+		}
+	}
+};
+
+// Rebuild all the lists in one pass through list i
+struct CountingRebuild {
+	template<class L>
+	static void rebuild(L &l, int i) {
+		typedef typename L::Node Node;
+		// this holds a list of all the predecessors of the current node
+		Node *prev[L::hmax+1];
+		for (int j = i + 1; j <= l.h; j++) {
+			l.n[j] = 0;
+			prev[j] = l.sentinel;
+		}
+		Node *u = l.sentinel;
+		for (int q = 1; q <= l.n[i]; q++) {
+			int top = i + __builtin_ctz(q);
+			assert(top <= l.h);
+			u = l.promote(u, i, top);
+			for (int j = i+1; j <= top; j++) {
+				l.n[j]++;
+				prev[j]->nx[j].set(u);
+				prev[j] = u;
+			}
+		}
+		for (int j = i+1; j <= l.h; j++)
+			prev[j]->nx[j].clear();
+	}
+};
+
+// Every node has room for all h+1 lists
+struct FullHeightAlloc {
+	struct Header { };
+
+	template<class Node>
+	Node *newNode(int height, int h) {
+		Node *u = (Node *) malloc(sizeof(Node) + (h + 1) * sizeof(u->nx[0]));
+		for (int i = 0; i <= h; i++)
+			u->nx[i].clear();
+		return u;
+	}
+	template<class Node>
+	bool fits(Node *u, int height) { return true; }
+	template<class Node>
+	Node *resize(Node *u, int height) { return u; }
+	template<class Node>
+	void deleteNode(Node *u) { free(u); }
+	bool overfull(int n0) { return false; }
+};
+
+// A node of height h has room for 2^ceil(log_2(h+1)) lists
+struct SizeClassAlloc {
+	struct Header {
+		unsigned char type; // the node has room for 1 << type lists
+	};
+
+	double space_factor; // max pointers/keys per node
+	size_t space; // the total size of all nodes
+
+	SizeClassAlloc() : space_factor(8), space(0) { }
+
+	// Compute the type of a node of height h, i.e., ceil(log_2(h+1))
+	static inline size_t h2t(size_t h) {
+		return (h == 0) ? 0 : 8*sizeof(int) - __builtin_clz(h);
+	}
+
+	template<class Node>
+	Node *newNode(int height, int h) {
+		size_t type = h2t(height);
+		size_t m = 1 << type;
+		Node *u = (Node *) malloc(sizeof(Node) + m * sizeof(u->nx[0]));
+		u->type = type;
+		space += m;
+		for (size_t i = 0; i < m; i++)
+			u->nx[i].clear();
+		return u;
+	}
+	template<class Node>
+	bool fits(Node *u, int height) { return (size_t)height < (1UL << u->type); }
+	// Only a node whose key is trivially copyable can be realloc()ed
+	template<class Node>
+	Node *reallocNode(Node *u, size_t bytes, std::true_type) {
+		return (Node *) realloc((void *)u, bytes);
+	}
+	template<class Node>
+	Node *reallocNode(Node *u, size_t bytes, std::false_type) {
+		typedef decltype(u->x) T;
+		Node *v = (Node *) malloc(bytes);
+		new (&v->x) T(std::move(u->x));
+		memcpy((void *)v->nx, (void *)u->nx, (1 << u->type) * sizeof(u->nx[0]));
+		u->x.~T();
+		free(u);
+		return v;
+	}
+
+	template<class Node>
+	Node *resize(Node *u, int height) {
+		size_t m0 = 1 << u->type;
+		size_t type = h2t(height);
+		size_t m = 1 << type;
+		u = reallocNode(u, sizeof(Node) + m * sizeof(u->nx[0]),
+				std::integral_constant<bool,
+				std::is_trivially_copyable<decltype(u->x)>::value>());
+		u->type = type;
+		for (size_t i = m0; i < m; i++)
+			u->nx[i].clear();
+		space += m - m0;
+		return u;
+	}
+	template<class Node>
+	void deleteNode(Node *u) {
+		space -= 1 << u->type;
+		free(u);
+	}
+	bool overfull(int n0) { return space > space_factor * n0; }
+};
+
+template<class T, class Layout, class Rebuild, class Alloc>
+class TodoListBase {
+protected:
+	friend Rebuild;
+
+	// Global constants
+	const static int hmax = 100;       // maximum number of levels
+
+	struct Node;
+	typedef typename Layout::template Slot<T, Node> NX;
+
+	struct Node : public Alloc::Header {
+		T x;      // data
+		NX nx[];  // a stack of next pointers
+	};
+
+	int h;    // there are h+1 lists numbered 0,...,h
+	int *n;   // n[i] is the size of the i'th list
+	Node *sentinel; // sentinel->nx[i].next is the first element of list i
+	Alloc alloc;
+
+	double eps; // the value of epsilon
+	int *a; // precomputed list size thresholds a[i] ~= (2-eps)^i
+
+	// FIXME: for profiling information
+	int *rebuild_freqs;
+
+	void init(T *data, int n);
+	Node *newNode(int height, const T &x) {
+		Node *u = alloc.template newNode<Node>(height, h);
+		new (&u->x) T(x);
+		return u;
+	}
+	void deleteNode(Node *u) {
+		u->x.~T();
+		alloc.deleteNode(u);
+	}
+	void rebuild();
+	void rebuild(int i) {
+		rebuild_freqs[i]++;
+		Rebuild::rebuild(*this, i);
+	}
+	Node *promote(Node *w, int i, int top);
+
+	void sanity();
+
+public:
+	TodoListBase(double eps0 = .3, T *data = NULL, int n0 = 0);
+	~TodoListBase();
+	T find(T x);
+	bool add(T x);
+	int size() { return n[0]; }
+	void printOn(std::ostream &out);
+};
+
+template<class T, class L, class R, class A>
+TodoListBase<T,L,R,A>::TodoListBase(double eps0, T *data, int n0) {
+	eps = eps0;
+	rebuild_freqs = new int[hmax+1]();
+	double base_a = 2.0-eps;
+	a = new int[hmax+1];
+	for (int i = 0; i <= hmax; i++)
+		a[i] = pow(base_a, i);
+
+	init(data, n0);
+}
+
+template<class T, class L, class R, class A>
+void TodoListBase<T,L,R,A>::init(T *data, int n0) {
+
+	// Compute critical values depending on epsilon and n
+	h = max(0.0, ceil(log(n0) / log(2-eps)));
+
+	n = new int[h + 1]();
+	n[0] = n0;
+	sentinel = newNode(h, T());
+	Node *prev = sentinel;
+	for (int i = 0; i < n0; i++) {
+		Node *u = newNode(__builtin_ctz(i+1), data[i]);
+		prev->nx[0].set(u);
+		prev = u;
+	}
+	rebuild(0);
+}
+
+template<class T, class L, class R, class A>
+void TodoListBase<T,L,R,A>::rebuild() {
+	// time to rebuild --- free everything and start over
+	T *data = new T[n[0]];
+	Node *prev = sentinel;
+	Node *u = sentinel->nx[0].next;
+	for (int j = 0; j < n[0]; j++) {
+		data[j] = u->x;
+		deleteNode(prev);
+		prev = u;
+		u = u->nx[0].next;
+	}
+	deleteNode(prev);
+	int enn = n[0];
+	delete[] n;
+	init(data, enn);
+	delete[] data;
+}
+
+// Make sure that u = w->nx[i].next has room to be in lists 0,...,top,
+// where w is u's predecessor in list i. Returns u, which may have moved.
+template<class T, class L, class R, class A>
+typename TodoListBase<T,L,R,A>::Node*
+TodoListBase<T,L,R,A>::promote(Node *w, int i, int top) {
+	Node *u = w->nx[i].next;
+	if (alloc.fits(u, top))
+		return u;
+	Node *u_new = alloc.resize(u, top);
+	if (u_new != u) {
+		// w's successors on lists i-1,...,0 are at most one step away
+		for (int j = i; j >= 0; j--) {
+			if (w->nx[j].next != u) w = w->nx[j].next;
+			w->nx[j].next = u_new;
+		}
+	}
+	return u_new;
+}
+
+template<class T, class L, class R, class A>
+T TodoListBase<T,L,R,A>::find(T x) {
+	Node *u = sentinel;
+	typename NX::Key kx = NX::key(x);
+	for (int i = h; i >= 0; i--) {
+		NX &s = u->nx[i];
+		s.prefetch(i);
+		if (s.next != NULL && s.less(kx, x))
+			u = s.next;
+	}
+	return (u->nx[0].next == NULL) ? T() : u->nx[0].value();
+}
+
+template<class T, class L, class R, class A>
+bool TodoListBase<T,L,R,A>::add(T x) {
+	// search for x and keep track of the search path
+	Node *path[hmax]; // FIXME: hard upper-bound
+	Node *u = sentinel;
+	typename NX::Key kx = NX::key(x);
+	int i;
+	for (i = h; i >= 0; i--) {
+		if (u->nx[i].next != NULL && u->nx[i].less(kx, x))
+			u = u->nx[i].next;
+		path[i] = u;
+	}
+
+	// abort if x is already here
+	Node *w = u->nx[0].next;
+	if (w != NULL && w->x == x)
+		return false;
+
+	// insert x everywhere along the search path
+	w = newNode(h, x);
+	for (i = h; i >= 0; i--) {
+		w->nx[i] = path[i]->nx[i];
+		path[i]->nx[i].set(w);
+		n[i]++;
+	}
+
+	// check if we need to add another level on the bottom, or if we need to
+	// rebuild because space is too high
+	if (n[0] > a[h] || alloc.overfull(n[0]))
+		rebuild();
+
+	// do partial rebuilding, if necessary
+	if (n[h] > 1) {
+		for (i = h-1; n[i] > a[h-i]; i--);
+		assert(i >= 0);
+		rebuild(i);
+	}
+	return true;
+}
+
+template<class T, class L, class R, class A>
+TodoListBase<T,L,R,A>::~TodoListBase() {
+	delete[] n;
+	delete[] a;
+	delete[] rebuild_freqs;
+	Node *prev = sentinel;
+	while (prev != NULL) {
+		Node *u = prev->nx[0].next;
+		deleteNode(prev);
+		prev = u;
+	}
+}
+
+template<class T, class L, class R, class A>
+void TodoListBase<T,L,R,A>::sanity() {
+	assert(n[h] <= 1);
+	for (int i = 0; i <= h; i++) {
+		Node *u = sentinel;
+		for (int j = 0; j < n[i]; j++) {
+			assert(u == sentinel || u->x < u->nx[i].next->x);
+			assert(u->nx[i].value() == u->nx[i].next->x);
+			u = u->nx[i].next;
+		}
+		assert(u->nx[i].next == NULL);
+	}
+}
+
+template<class T, class L, class R, class A>
+void TodoListBase<T,L,R,A>::printOn(std::ostream &out) {
+	const int max_print = 50;
+	out << "WSSkiplist: n = " << n[0] << ", k = " << h << endl;
+	for (int i = h; i >= 0; i--) {
+		out << "L(" << i << "): ";
+		if (n[0] <= max_print) {
+			Node *u = sentinel->nx[i].next;
+			for (int j = 0; j < n[i]; j++) {
+				out << u->x << ",";
+				u = u->nx[i].next;
+			}
+			assert(u == NULL);
+		}
+		out << " n(" << i << ") = " << n[i]
+		     << " (rebuilt " << rebuild_freqs[i] << " times)" << endl;
+	}
+}
+
+template<class T, class L, class R, class A>
+ostream& operator<<(ostream &out, TodoListBase<T,L,R,A> &sl) {
+	sl.printOn(out);
+	return out;
+}
+
+} // fastws namespace
+
+#endif // FASTWS_TODOLISTBASE_H_
@@ -1,13 +1,17 @@
 #include <cstdlib>
 #include <cstdio>
+#include <climits>
 #include <iostream>
 #include <string>
 #include <algorithm>
 #include <iterator>
 #include <set>
+#include <map>
+#include <vector>
 #include <chrono>
 
 #include <unistd.h>
+#include <sys/resource.h>
 
 #include "BinarySearchTree.h"
 #include "ScapegoatTree.h"
@@ -20,6 +24,11 @@
 #include "TodoList2.h"
 #include "TodoList3.h"
 #include "TodoList4.h"
+#include "ExternalTodoList.h"
+#include "SortedArray.h"
+#include "EytzingerArray.h"
+#include "LogStructuredArray.h"
+#include "STree.h"
 
 using namespace std;
 
@@ -55,15 +64,16 @@ public:
 	static void resetComparisons() {
 		comparisons = 0;
 	}
+	static void addComparisons(size_t c) {
+		comparisons += c;
+	}
 	Integer() {
 		data = 0;
 	}
 	Integer(int i) {
 		data = i;
 	}
-	Integer(const Integer &i) {
-		data = i.data;
-	}
+	Integer(const Integer &i) = default;
 	bool operator <(const Integer &other) {
 		delay();
 		return data < other.data;
@@ -90,6 +100,42 @@ ostream& operator<<(ostream &out, Integer &ds) {
 	return out;
 }
 
+// Lists of Integers can end with a sentinel holding INT_MAX
+namespace ods {
+template<>
+struct Infinity<Integer> {
+	static const bool exists = true;
+	static Integer value() { return INT_MAX; }
+};
+}
+
+// and can be hashed, for TodoList4's hash index
+namespace std {
+template<>
+struct hash<Integer> {
+	size_t operator()(const Integer &x) const { return hash<int>()(x); }
+};
+}
+
+// An Integer is laid out like an int, so STree nodes of Integers can be
+// searched with the SIMD comparisons for ints.  That counts as comparing
+// x with all 16 keys
+#ifdef __SSE2__
+namespace todolist {
+template<>
+struct STreeRank<Integer> {
+	static_assert(sizeof(Integer) == sizeof(int), "Integer isn't an int");
+	static inline unsigned rank(Integer *keys, Integer x) {
+		Integer::addComparisons(16);
+		return STreeRank<int>::rank((int *)keys, x);
+	}
+};
+}
+#endif
+
+// The benchmarks do searches*n searches
+size_t searches = 5;
+
 
 // A bunch of sequence generators that generate the i'th element in a sequence
 // of length n
@@ -109,11 +155,47 @@ int requential_data(size_t i, size_t n) {
 	return 5*(n-i-1);
 }
 
+// Keys whose density falls off like x^(-3/4), so the small ones are
+// crowded and the large ones are sparse
+int skewed_data(size_t i, size_t n) {
+	double u = (double)rand() / RAND_MAX;
+	return 5*n * u*u*u*u;
+}
+
+int skewed_search(size_t i, size_t n) {
+	return skewed_data(i, n) - 2;
+}
+
 int shuffle_data(size_t i, size_t n) {
 	int sn = ceil(sqrt(n));
 	return (i*sn + i/sn) % n;
 }
 
+// URL-like keys for the string tests.  Like the row keys of a web crawl
+// table, each is a host name with its components reversed, followed by a
+// path.  Host names are made of random syllables and about 16 keys share
+// each host
+string url_data(size_t i, size_t n) {
+	static const char *tlds[] = { "com", "org", "net", "edu", "io", "de",
+			"uk.co" };
+	static const char *syllables[] = { "ka", "lo", "mi", "ne", "ru", "sta",
+			"tor", "vel", "xen", "zu", "bar", "qui", "dor", "pin", "gal", "fen" };
+	size_t host = rand() % (n/16 + 1);
+	string s = tlds[host % 7];
+	s += '.';
+	for (size_t h = host/7 + 1; h > 0; h /= 16)
+		s += syllables[h % 16];
+	s += ".www/";
+	for (int d = rand() % 3; d >= 0; d--) {
+		s += syllables[rand() % 16];
+		s += syllables[rand() % 16];
+		s += '/';
+	}
+	s += to_string(rand() % 100000);
+	s += ".html";
+	return s;
+}
+
 template<class Dict>
 void build(Dict &d, const char *name, size_t n,
 		int (*gen_add)(size_t, size_t)) {
@@ -133,6 +215,77 @@ void build(Dict &d, const char *name, size_t n,
 			<< " " << c << endl;
 }
 
+// Time d.freeze() or, if freeze is false, d.thaw()
+template<class Dict>
+void freeze_thaw(Dict &d, const char *name, size_t n, bool freeze) {
+	auto start = std::chrono::high_resolution_clock::now();
+	if (freeze)
+		d.freeze();
+	else
+		d.thaw();
+	auto stop = std::chrono::high_resolution_clock::now();
+
+	std::chrono::duration<double> elapsed = stop-start;
+	cout << name << (freeze ? " FREEZE " : " THAW ") << n << " "
+			<< elapsed.count() << endl;
+}
+
+// Use d as a priority queue: push n keys, then n times pop the minimum and
+// push a key a little after it (like a scheduler's timestamps), then pop
+// everything
+template<class Dict>
+void push_pop(Dict &d, const char *name, size_t n) {
+	static long summer;
+	srand(1);
+	vector<int> keys(n), gaps(n);
+	for (size_t i = 0; i < n; i++) {
+		keys[i] = rand() % (5*n);
+		gaps[i] = 1 + rand() % (5*n);
+	}
+	Integer::resetComparisons();
+	long sum = 0;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (size_t i = 0; i < n; i++)
+		d.add(keys[i]);
+	for (size_t i = 0; i < n; i++) {
+		int x = d.deleteMin();
+		sum += x;
+		d.add(x + gaps[i]);
+	}
+	while (d.size() > 0)
+		sum += (int)d.deleteMin();
+	auto stop = std::chrono::high_resolution_clock::now();
+
+	std::chrono::duration<double> elapsed = stop-start;
+	cout << name << " PQ " << n << " " << elapsed.count()
+			<< " " << Integer::getComparisons() << endl;
+	summer += sum; // to make sure this isn't optimized away
+}
+
+// Like build(), but the keys are generated ahead of time and handed to
+// d.buildFrom() all at once
+template<class Dict>
+void bulk_build(Dict &d, const char *name, size_t n,
+		int (*gen_add)(size_t, size_t), int threads) {
+	srand(1);
+	vector<Integer> keys(n);
+	for (size_t i = 0; i < n; i++)
+		keys[i] = gen_add(i, n);
+	Integer::resetComparisons();
+
+	auto start = std::chrono::high_resolution_clock::now();
+	d.buildFrom(keys.begin(), keys.end(), threads);
+	auto stop = std::chrono::high_resolution_clock::now();
+
+	std::chrono::duration<double> elapsed = stop-start;
+	double avg = ((double)Integer::getComparisons()) / n;
+	double c = avg * log(2) / log(d.size());
+	cout << name << " ADD " << n << " " << elapsed.count()
+			<< " " << Integer::getComparisons()
+			<< " " << c << endl;
+}
+
 template<class Dict>
 void search(Dict &d, const char *name, size_t n,
 		int (*gen_search)(size_t, size_t)) {
@@ -141,12 +294,73 @@ void search(Dict &d, const char *name, size_t n,
 	Integer::resetComparisons();
 	long sum = 0;
 	auto start = std::chrono::high_resolution_clock::now();
-	for (size_t i = 0; i < 5*n; i++)
+	for (size_t i = 0; i < searches*n; i++)
 		sum += (int)d.find(gen_search(i, n));
 	auto stop = std::chrono::high_resolution_clock::now();
 
 	std::chrono::duration<double> elapsed = stop - start;
-	double avg = ((double)Integer::getComparisons()) / (5*n);
+	double avg = ((double)Integer::getComparisons()) / (searches*n);
+	double c = avg * log(2) / log(d.size());
+
+	cout << name << " FIND " << n << " " << elapsed.count()
+			<< " " <<  Integer::getComparisons()
+			<< " " << c << endl;
+
+	summer += sum; // to make sure this isn't optimized away
+}
+
+
+// Do searches*n exact-match queries twice, once with find(x) == x and once
+// with d.contains(x), and report how much faster contains() is
+template<class Dict>
+void membership(Dict &d, const char *name, size_t n,
+		int (*gen_search)(size_t, size_t)) {
+	static size_t summer;
+	double t[2];
+	for (int k = 0; k < 2; k++) {
+		Integer::resetComparisons();
+		size_t hits = 0;
+		auto start = std::chrono::high_resolution_clock::now();
+		for (size_t i = 0; i < searches*n; i++) {
+			Integer x = gen_search(i, n);
+			hits += (k == 0) ? (d.find(x) == x) : d.contains(x);
+		}
+		auto stop = std::chrono::high_resolution_clock::now();
+
+		std::chrono::duration<double> elapsed = stop - start;
+		t[k] = elapsed.count();
+		cout << name << (k == 0 ? " FINDEQ " : " CONTAINS ") << n << " "
+				<< t[k] << " " << Integer::getComparisons() << endl;
+		summer += hits; // to make sure this isn't optimized away
+	}
+	cout << "I: contains() is " << t[0] / t[1] << " times as fast as"
+			<< " find(x) == x" << endl;
+}
+
+// Like search(), but the queries are handed to d.findBatch() in chunks so
+// that g of them can be in flight at once
+template<class Dict>
+void search_batch(Dict &d, const char *name, size_t n,
+		int (*gen_search)(size_t, size_t), size_t g) {
+	static int summer;
+	const size_t chunk = 1024;
+	Integer xs[chunk], ans[chunk];
+
+	Integer::resetComparisons();
+	long sum = 0;
+	auto start = std::chrono::high_resolution_clock::now();
+	for (size_t i = 0; i < searches*n; i += chunk) {
+		size_t m = min(chunk, searches*n - i);
+		for (size_t j = 0; j < m; j++)
+			xs[j] = gen_search(i+j, n);
+		d.findBatch(xs, ans, m, g);
+		for (size_t j = 0; j < m; j++)
+			sum += (int)ans[j];
+	}
+	auto stop = std::chrono::high_resolution_clock::now();
+
+	std::chrono::duration<double> elapsed = stop - start;
+	double avg = ((double)Integer::getComparisons()) / (searches*n);
 	double c = avg * log(2) / log(d.size());
 
 	cout << name << " FIND " << n << " " << elapsed.count()
@@ -165,6 +379,50 @@ void build_and_search(Dict &d, const char *name, size_t n,
 	search(d, name, n, gen_search);
 }
 
+// Like build_and_search(), but the searches are batched if g > 0
+template<class Dict>
+void build_and_search_batch(Dict &d, const char *name, size_t n,
+		int (*gen_add)(size_t, size_t), int (*gen_search)(size_t, size_t),
+		size_t g) {
+	build(d, name, n, gen_add);
+	if (g > 0)
+		search_batch(d, name, n, gen_search, g);
+	else
+		search(d, name, n, gen_search);
+}
+
+// Like build_and_search(), but with string keys from url_data().  The keys
+// are generated ahead of time, so only the dictionary operations are
+// timed, and half of the searches are for keys that are present.  We don't
+// count string comparisons.
+template<class Dict>
+void build_and_search_strings(Dict &d, const char *name, size_t n) {
+	static size_t summer;
+	vector<string> keys(n), queries(5*n);
+	srand(1);
+	for (size_t i = 0; i < n; i++)
+		keys[i] = url_data(i, n);
+	for (size_t i = 0; i < 5*n; i++)
+		queries[i] = (rand() % 2) ? keys[rand() % n] : url_data(i, n);
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (size_t i = 0; i < n; i++)
+		d.add(keys[i]);
+	auto stop = std::chrono::high_resolution_clock::now();
+	std::chrono::duration<double> elapsed = stop - start;
+	cout << name << " ADD " << n << " " << elapsed.count() << " 0 0" << endl;
+
+	size_t sum = 0;
+	start = std::chrono::high_resolution_clock::now();
+	for (size_t i = 0; i < 5*n; i++)
+		sum += d.find(queries[i]).size();
+	stop = std::chrono::high_resolution_clock::now();
+	elapsed = stop - start;
+	cout << name << " FIND " << n << " " << elapsed.count() << " 0 0" << endl;
+
+	summer += sum; // to make sure this isn't optimized away
+}
+
 template<class Dict1, class Dict2>
 void test_build(Dict1 &d1, Dict2 &d2, int n) {
 	srand(1);
@@ -183,6 +441,22 @@ void test_search(Dict1 &d1, Dict2 &d2, int n) {
 	}
 }
 
+// Check that d1.findBatch() agrees with d2.find() on the searches done by
+// test_search()
+template<class Dict1, class Dict2>
+void test_search_batch(Dict1 &d1, Dict2 &d2, int n, size_t g) {
+	int *xs = new int[5*n];
+	int *ans = new int[5*n];
+	srand(2);
+	for (int i = 0; i < 5*n; i++)
+		xs[i] = rand() % (5*(n+1))-2;
+	d1.findBatch(xs, ans, 5*n, g);
+	for (int i = 0; i < 5*n; i++)
+		assert(ans[i] == d2.find(xs[i]));
+	delete[] xs;
+	delete[] ans;
+}
+
 // Compare the results of performing the same operations on two dictionaries
 template<class Dict1, class Dict2>
 void test_dicts(Dict1 &d1, Dict2 &d2, int n) {
@@ -190,38 +464,6 @@ void test_dicts(Dict1 &d1, Dict2 &d2, int n) {
 	test_search(d1, d2, n);
 }
 
-// Return the index of the smallest value that is greater than or equal
-// to x. If no such value exists, then return n0.
-// Warning: n0 must be greater than 0.
-template<class T>
-T binarySearch(T x, T *data, size_t n) {
-	T ans = (T)0;
-	while (n > 0) {
-		size_t m = n/2;
-		if (x < data[m]) {
-			ans = data[m];
-			n = m; // recurse on data[0,...,m-1]
-		} else if (x > data[m]) {
-			data += m+1; // recurse on data[m+1,...n]
-			n -= m+1;
-		} else {
-			return data[m];
-		}
-	}
-	return ans;
-}
-
-template<class T>
-class SortedArray {
-protected:
-	T *data;
-	size_t n;
-public:
-	SortedArray(T *data0, size_t n0) : data(data0), n(n0) {	}
-	int size() { return n; }
-	T find(T x) { return binarySearch(x, data, n); }
-};
-
 template<class T>
 class StlSet {
 protected:
@@ -234,13 +476,85 @@ public:
 
 	T find(T x) {
 		typename std::set<T>::iterator it = s.lower_bound(x);
-		if (it == s.end()) return (T)0;
+		if (it == s.end()) return T();
 		return *it;
 	}
 
+	T deleteMin() {
+		if (s.empty()) return T();
+		T x = *s.begin();
+		s.erase(s.begin());
+		return x;
+	}
+
 };
 
+// Compare a TodoListBase with the given policies to TodoList4
+template<class Layout, class Rebuild, class Alloc>
+void test_tdl(size_t n) {
+	todolist::TodoListBase<int, Layout, Rebuild, Alloc> tdl;
+	todolist::TodoList4<int> tdl4;
+	test_dicts(tdl, tdl4, n);
+}
+
+template<class Layout>
+void test_tdl_layout(size_t n) {
+	test_tdl<Layout, todolist::HalvingRebuild, todolist::FullHeightAlloc>(n);
+	test_tdl<Layout, todolist::HalvingRebuild, todolist::SizeClassAlloc>(n);
+	test_tdl<Layout, todolist::CountingRebuild, todolist::FullHeightAlloc>(n);
+	test_tdl<Layout, todolist::CountingRebuild, todolist::SizeClassAlloc>(n);
+}
+
+// Keep a hash index through every way nodes can move or go away
+template<class L>
+void test_hash_index(size_t n) {
+	L tdl4;
+	tdl4.setSpaceFactor(2.5);
+	tdl4.setIncrementalCompaction(true);
+	tdl4.setHashIndex(true);
+	std::set<int> s;
+	srand(6);
+	for (int r = 0; r < 8; r++) {
+		tdl4.setBufferSize(r % 2 ? 32 : 0);
+		for (size_t i = 0; i < n/2; i++) {
+			int x = rand() % (5*n+1);
+			assert(tdl4.add(x) == s.insert(x).second);
+		}
+		for (size_t i = 0; i < n/8; i++) {
+			int x = rand() % (5*n+1);
+			assert(tdl4.remove(x) == (s.erase(x) == 1));
+		}
+		for (size_t i = 0; i < n/16 && !s.empty(); i++) {
+			assert(tdl4.deleteMin() == *s.begin());
+			s.erase(s.begin());
+		}
+		int lo = rand() % (5*n+1), hi = lo + rand() % (n/2 + 1);
+		tdl4.eraseRange(lo, hi);
+		s.erase(s.lower_bound(lo), s.lower_bound(hi));
+		L *right = tdl4.split(rand() % (5*n+1));
+		if (r % 2)
+			right->setHashIndex(false);
+		tdl4.join(*right);
+		delete right;
+		assert(tdl4.size() == (int)s.size());
+		for (size_t i = 0; i < n; i++) {
+			int x = rand() % (5*n+2) - 1, y;
+			bool here = s.count(x) == 1;
+			assert(tdl4.contains(x) == here);
+			assert(tdl4.findExact(x, y) == here && (!here || y == x));
+		}
+	}
+}
+
 void sanity_tests(size_t n) {
+	typedef todolist::TodoList4<int, todolist::KeyCache<int>,
+			todolist::HashIndexed> HashedTodoList4;
+	typedef todolist::TodoList4<int, todolist::KeyCache<int>,
+			todolist::NoIndex, todolist::Untimed, todolist::CompactRefs>
+			CompactTodoList4;
+	test_tdl_layout<todolist::PlainLayout>(n);
+	test_tdl_layout<todolist::NXLayout>(n);
+	test_tdl_layout<todolist::PrefetchNXLayout>(n);
 	{
 		todolist::TodoList4<int> tdl4;
 		todolist::TodoList3<int> tdl3;
@@ -280,6 +594,481 @@ void sanity_tests(size_t n) {
 		StlSet<int> s;
 		todolist::TodoList4<int> tdl4;
 		test_dicts(s, tdl4, n);
+		test_search_batch(tdl4, s, n, 1);
+		test_search_batch(tdl4, s, n, 13);
+		ods::SkiplistSSet<int> sl;
+		ods::RedBlackTree1<int> rbt;
+		test_build(sl, rbt, n);
+		test_search_batch(sl, rbt, n, 13);
+		test_search_batch(rbt, sl, n, 13);
+	}
+	{
+		todolist::TodoList4<int> tdl4;
+		todolist::TodoList4<int> tdl4l;
+		tdl4l.setLearned(true);
+		test_dicts(tdl4, tdl4l, n);
+		test_build(tdl4, tdl4l, n);
+		test_search(tdl4, tdl4l, n);
+	}
+	for (int threads = 1; threads <= 5; threads += 2) {
+		vector<int> keys(n);
+		srand(1);
+		for (size_t i = 0; i < n; i++)
+			keys[i] = rand() % (5*n);
+		StlSet<int> s;
+		todolist::TodoList4<int> tdl4;
+		tdl4.add(7);
+		tdl4.buildFrom(keys.begin(), keys.end(), threads);
+		srand(1);
+		for (size_t i = 0; i < n; i++)
+			s.add(rand() % (5*n));
+		assert(tdl4.size() == s.size());
+		test_search(s, tdl4, n);
+		test_dicts(s, tdl4, n);
+		todolist::TodoList4<int> tdl4m;
+		tdl4m.setMultiset(true);
+		tdl4m.buildFrom(keys.begin(), keys.end(), threads);
+		assert(tdl4m.size() == (int)n);
+		std::multiset<int> ms(keys.begin(), keys.end());
+		for (size_t i = 0; i < n; i++)
+			assert(tdl4m.count(keys[i]) == ms.count(keys[i]));
+	}
+	{
+		char path[] = "/tmp/todolist-XXXXXX";
+		int fd = mkstemp(path);
+		assert(fd >= 0);
+		close(fd);
+		{
+			StlSet<int> s;
+			todolist::ExternalTodoList<int> etdl(path, n/8 + 1);
+			test_dicts(s, etdl, n);
+			etdl.merge();
+			test_search(s, etdl, n);
+			vector<int> more;
+			for (size_t i = 0; i < n; i++)
+				more.push_back(5*n + 3*i);
+			etdl.append(more.data(), more.size());
+			for (size_t i = 0; i < n; i++)
+				s.add(more[i]);
+			etdl.add(-1);
+			s.add(-1);
+			assert(etdl.size() == s.size());
+			test_search(s, etdl, 2*n);
+		}
+		unlink(path);
+	}
+	{
+		// deleteMin() until empty, with some adds in between
+		todolist::TodoList4<int> tdl4;
+		ods::SkiplistSSet<int> sl;
+		std::set<int> s;
+		srand(5);
+		for (size_t i = 0; i < 2*n; i++) {
+			int x = rand() % (5*n);
+			if (i < n || rand() % 3 == 0) {
+				s.insert(x);
+				tdl4.add(x);
+				sl.add(x);
+			}
+			if (i >= n || s.empty()) continue;
+			int m = *s.begin();
+			assert(tdl4.peekMin() == m);
+			assert(tdl4.deleteMin() == m && sl.deleteMin() == m);
+			s.erase(s.begin());
+			assert(tdl4.size() == (int)s.size() && sl.size() == (int)s.size());
+		}
+		while (!s.empty()) {
+			int m = *s.begin();
+			s.erase(s.begin());
+			assert(tdl4.deleteMin() == m && sl.deleteMin() == m);
+			if (rand() % 16 == 0)
+				test_search(tdl4, sl, n);
+		}
+		assert(tdl4.size() == 0 && tdl4.deleteMin() == 0);
+	}
+	test_hash_index<HashedTodoList4>(n);
+	test_hash_index<todolist::TodoList4<int, todolist::KeyCache<int>,
+			todolist::HashIndexed, todolist::Untimed, todolist::CompactRefs> >(n);
+	{
+		// erase some ranges and single values, adding more in between
+		todolist::TodoList4<int> tdl4;
+		std::set<int> s;
+		srand(4);
+		for (int r = 0; r < 20; r++) {
+			for (size_t i = 0; i < n/4; i++) {
+				int x = rand() % (5*n);
+				assert(tdl4.add(x) == s.insert(x).second);
+			}
+			int lo = rand() % (5*n+2) - 1;
+			int hi = lo + rand() % (5*n/(r+1) + 1);
+			std::set<int>::iterator a = s.lower_bound(lo), b = s.lower_bound(hi);
+			assert(tdl4.eraseRange(lo, hi) == (size_t)std::distance(a, b));
+			s.erase(a, b);
+			for (size_t i = 0; i < n/8; i++) {
+				int x = rand() % (5*n);
+				assert(tdl4.remove(x) == (s.erase(x) == 1));
+			}
+			assert(tdl4.size() == (int)s.size());
+			for (size_t i = 0; i < n; i++) {
+				int x = rand() % (5*n+2) - 1;
+				std::set<int>::iterator it = s.lower_bound(x);
+				assert(tdl4.find(x) == (it == s.end() ? 0 : *it));
+			}
+		}
+	}
+	for (int k = 1; k <= 4; k++) {
+		// split somewhere and join the pieces back, in either order
+		StlSet<int> s;
+		todolist::TodoList4<int> tdl4;
+		test_build(s, tdl4, n);
+		int x = rand() % (5*n+2) - 1;
+		todolist::TodoList4<int> *right = tdl4.split(x);
+		StlSet<int> sl, sr;
+		for (std::set<int>::iterator it = s.s.begin(); it != s.s.end(); ++it)
+			(*it < x ? sl : sr).add(*it);
+		assert(tdl4.size() == sl.size() && right->size() == sr.size());
+		test_search(tdl4, sl, n);
+		test_search(*right, sr, n);
+		todolist::TodoList4<int> &whole = (k % 2) ? tdl4 : *right;
+		todolist::TodoList4<int> &empty = (k % 2) ? *right : tdl4;
+		whole.join(empty);
+		assert(empty.size() == 0 && whole.size() == s.size());
+		test_search(whole, s, n);
+		test_dicts(s, whole, n);
+		StlSet<int> s2;
+		test_dicts(s2, empty, n);
+		delete right;
+	}
+	{
+		StlSet<int> s;
+		todolist::TodoList4<int> tdl4;
+		tdl4.setSpaceFactor(2.5);
+		tdl4.setIncrementalCompaction(true);
+		test_dicts(s, tdl4, n);
+	}
+	{
+		StlSet<string> s;
+		todolist::TodoList4<string, todolist::KeyCache<string>,
+				todolist::HashIndexed> tdl4;
+		todolist::TodoList4<string, todolist::NoKeyCache<string>,
+				todolist::HashIndexed> tdl4n;
+		tdl4n.setHashIndex(true);
+		srand(1);
+		for (size_t i = 0; i < n; i++) {
+			if (i == n/2)
+				tdl4.setHashIndex(true);
+			string x = url_data(i, n);
+			bool added = s.add(x);
+			assert(tdl4.add(x) == added);
+			assert(tdl4n.add(x) == added);
+			string y = x.substr(0, rand() % (x.size() + 1));
+			assert(tdl4.find(y) == s.find(y));
+			assert(tdl4n.find(y) == s.find(y));
+			bool here = s.s.count(y) == 1;
+			assert(tdl4.contains(y) == here && tdl4n.contains(y) == here);
+		}
+		for (size_t i = 0; i < 5*n; i++) {
+			string x = url_data(i, n);
+			assert(tdl4.find(x) == s.find(x));
+		}
+	}
+	for (size_t b = 0; b <= 16; b += 16) {
+		todolist::TodoList4<int> tdl4;
+		tdl4.setMultiset(true);
+		tdl4.setBufferSize(b);
+		std::multiset<int> ms;
+		srand(3);
+		for (size_t i = 0; i < n; i++) {
+			int x = rand() % (n/4 + 1);
+			assert(tdl4.add(x));
+			ms.insert(x);
+		}
+		assert(tdl4.size() == (int)ms.size());
+		for (size_t i = 0; i < n; i++) {
+			int x = rand() % (n/4 + 3) - 1;
+			assert(tdl4.count(x) == ms.count(x));
+			std::multiset<int>::iterator lo = ms.lower_bound(x);
+			std::multiset<int>::iterator hi = ms.upper_bound(x);
+			std::pair<int,int> r = tdl4.equalRange(x);
+			assert(r.first == (lo == ms.end() ? 0 : *lo));
+			assert(r.second == (hi == ms.end() ? 0 : *hi));
+		}
+	}
+	{
+		todolist::TodoList4<int> tdl4;
+		todolist::LinkedTodoList<int> ltdl;
+		test_dicts(tdl4, ltdl, n);
+	}
+	for (int k = 0; k < 2; k++) {
+		// mostly increasing keys, so add() mostly appends, with the tails
+		// kept through every other kind of change
+		todolist::TodoList4<int> tdl4;
+		tdl4.setIncrementalCompaction(k == 1);
+		tdl4.setSpaceFactor(3);
+		std::set<int> s;
+		srand(7);
+		int next = 0;
+		for (size_t i = 0; i < 4*n; i++) {
+			int x = (rand() % 8 == 0) ? rand() % (next+1) : (next += 1 + rand() % 4);
+			assert(tdl4.add(x) == s.insert(x).second);
+			switch (rand() % 64) {
+			case 0:
+				if (!s.empty()) {
+					assert(tdl4.deleteMin() == *s.begin());
+					s.erase(s.begin());
+				}
+				break;
+			case 1:
+				assert(tdl4.remove(next) == (s.erase(next) == 1));
+				break;
+			case 2: {
+				int lo = rand() % (next+1);
+				tdl4.eraseRange(lo, next + 1);
+				s.erase(s.lower_bound(lo), s.end());
+				break;
+			}
+			case 3: {
+				todolist::TodoList4<int> *right = tdl4.split(rand() % (next+1));
+				tdl4.join(*right);
+				delete right;
+				break;
+			}
+			}
+			if (i % 64 == 0) {
+				int y = rand() % (next+2);
+				std::set<int>::iterator it = s.lower_bound(y);
+				assert(tdl4.find(y) == (it == s.end() ? 0 : *it));
+			}
+		}
+		assert(tdl4.size() == (int)s.size());
+		StlSet<int> s2;
+		s2.s = s;
+		test_search(tdl4, s2, n);
+	}
+	for (int k = 0; k < 3; k++) {
+		// built for skewed weights, then changed
+		StlSet<int> s;
+		HashedTodoList4 tdl4;
+		tdl4.setHashIndex(k == 2);
+		srand(5);
+		vector<std::pair<int,double> > kw;
+		for (size_t i = 0; i < n; i++) {
+			int x = rand() % (5*n);
+			s.add(x);
+			double w = (k == 0) ? 0 : pow(rand() % 1000 + 1, -1.5);
+			kw.push_back(std::make_pair(x, w));
+		}
+		tdl4.buildWeighted(kw.begin(), kw.end());
+		assert(tdl4.size() == s.size());
+		test_search(tdl4, s, n);
+		for (size_t i = 0; i < kw.size(); i++)
+			assert(tdl4.find(kw[i].first) == kw[i].first
+					&& tdl4.contains(kw[i].first));
+		test_dicts(s, tdl4, n);
+	}
+	for (int k = 0; k < 4; k++) {
+		// frozen, then thawed by changes, then frozen again
+		StlSet<int> s;
+		HashedTodoList4 tdl4;
+		tdl4.setHashIndex(k == 1);
+		tdl4.setMultiset(k == 2);
+		if (k == 3) {
+			vector<std::pair<int,double> > kw;
+			for (size_t i = 0; i < n; i++)
+				kw.push_back(std::make_pair((int)(rand() % (5*n)), rand() % 7));
+			tdl4.buildWeighted(kw.begin(), kw.end());
+			for (size_t i = 0; i < kw.size(); i++)
+				s.add(kw[i].first);
+		}
+		for (int round = 0; round < 2; round++) {
+			srand(round + 1);
+			for (size_t i = 0; i < n; i++) {
+				int x = rand() % (5*n);
+				bool added = s.add(x);
+				assert(tdl4.add(x) == (added || k == 2));
+			}
+			int size = tdl4.size();
+			tdl4.freeze();
+			assert(tdl4.isFrozen() && tdl4.size() == size);
+			test_search(tdl4, s, n);
+			test_search_batch(tdl4, s, n, 8);
+			bool added = s.add(1);
+			assert(tdl4.add(1) == (added || k == 2));
+			assert(tdl4.size() == size + (added || k == 2));
+			assert(tdl4.contains(n/2) == (s.find(n/2) == (int)n/2));
+			assert(!tdl4.isFrozen());
+			test_search(tdl4, s, n);
+		}
+	}
+	{
+		StlSet<string> s;
+		todolist::TodoList4<string> tdl4;
+		todolist::TodoList4<string, todolist::NoKeyCache<string> > tdl4n;
+		todolist::TodoList2<string> tdl2;
+		todolist::TodoList3<string> tdl3;
+		todolist::TodoListBase<string, todolist::PrefetchNXLayout,
+				todolist::CountingRebuild, todolist::SizeClassAlloc> tdlp;
+		for (size_t i = 0; i < n; i++) {
+			string x = url_data(i, n);
+			bool added = s.add(x);
+			assert(tdl4.add(x) == added && tdl4n.add(x) == added);
+			assert(tdl2.add(x) == added && tdl3.add(x) == added);
+			assert(tdlp.add(x) == added);
+		}
+		for (size_t i = 0; i < 5*n; i++) {
+			string x = url_data(i, n);
+			string y = x.substr(0, rand() % (x.size() + 1));
+			assert(tdl2.find(x) == s.find(x) && tdl2.find(y) == s.find(y));
+			assert(tdl3.find(x) == s.find(x) && tdl3.find(y) == s.find(y));
+			assert(tdlp.find(x) == s.find(x) && tdlp.find(y) == s.find(y));
+		}
+		tdl4.freeze();
+		tdl4n.freeze();
+		for (size_t i = 0; i < 5*n; i++) {
+			string x = url_data(i, n);
+			string y = x.substr(0, rand() % (x.size() + 1));
+			assert(tdl4.find(x) == s.find(x) && tdl4n.find(x) == s.find(x));
+			assert(tdl4.find(y) == s.find(y) && tdl4n.find(y) == s.find(y));
+		}
+	}
+	for (int k = 0; k < 2; k++) {
+		// values that expire, against a map from values to expiry times
+		typedef todolist::TodoList4<int, todolist::KeyCache<int>,
+				todolist::HashIndexed, todolist::Timed> TimedTodoList4;
+		typedef TimedTodoList4::Time Time;
+		const Time never = ~(Time)0;
+		TimedTodoList4 tdl4;
+		tdl4.setHashIndex(k == 1);
+		std::map<int,Time> m;
+		Time now = 0;
+		srand(11);
+		for (size_t i = 0; i < 4*n; i++) {
+			int x = rand() % (2*n + 1);
+			std::map<int,Time>::iterator it = m.find(x);
+			bool here = it != m.end() && it->second > now;
+			switch (rand() % 8) {
+			case 0:
+				assert(tdl4.add(x) == !here);
+				if (!here) m[x] = never;
+				break;
+			case 1:
+				assert(tdl4.remove(x) == here);
+				if (it != m.end()) m.erase(it);
+				break;
+			case 2:
+				now += rand() % 4;
+				tdl4.purgeExpired(now, rand() % 4);
+				break;
+			case 3:
+				if (rand() % 16 == 0) {
+					TimedTodoList4 *right = tdl4.split(x);
+					tdl4.join(*right);
+					delete right;
+				} else if (rand() % 16 == 0) {
+					tdl4.freeze();
+				}
+				break;
+			default: {
+				Time t = now + 1 + rand() % (n/4 + 1);
+				assert(tdl4.add(x, t) == !here);
+				m[x] = t;
+			}
+			}
+			int y = rand() % (2*n + 2);
+			it = m.lower_bound(y);
+			while (it != m.end() && it->second <= now) ++it;
+			assert(tdl4.find(y) == (it == m.end() ? 0 : it->first));
+			it = m.find(y);
+			assert(tdl4.contains(y) == (it != m.end() && it->second > now));
+			if (i % 64 == 0) {
+				it = m.begin();
+				while (it != m.end() && it->second <= now) ++it;
+				if (it != m.end()) {
+					assert(tdl4.deleteMin() == it->first);
+					m.erase(it);
+				}
+			}
+		}
+		tdl4.purgeExpired(now);
+		size_t live = 0;
+		for (std::map<int,Time>::iterator it = m.begin(); it != m.end(); ++it)
+			live += it->second > now;
+		assert(tdl4.size() == (int)live);
+	}
+	{
+		// 32-bit next pointers
+		StlSet<int> s;
+		CompactTodoList4 tdl4c;
+		test_dicts(s, tdl4c, n);
+	}
+	{
+		todolist::TodoList4<int, todolist::NoKeyCache<int>, todolist::NoIndex,
+				todolist::Untimed, todolist::CompactRefs> tdl4cn;
+		CompactTodoList4 tdl4c;
+		tdl4c.setSpaceFactor(2.5);
+		test_dicts(tdl4c, tdl4cn, n);
+	}
+	for (int k = 0; k < 2; k++) {
+		// lists with arenas of their own, built by several threads and
+		// joined, and the one that's left used after the other is gone
+		std::set<int> s;
+		std::vector<int> lo, hi;
+		for (size_t i = 0; i < 2*n; i++) {
+			int x = rand() % (10*n);
+			s.insert(x);
+			(x < (int)(5*n) ? lo : hi).push_back(x);
+		}
+		CompactTodoList4 *a = new CompactTodoList4();
+		CompactTodoList4 *b = new CompactTodoList4();
+		a->buildFrom(lo.begin(), lo.end(), 4);
+		b->buildFrom(hi.begin(), hi.end(), 4);
+		if (k == 1)
+			std::swap(a, b);
+		a->join(*b);
+		delete b;
+		for (size_t i = 0; i < n; i++) {
+			int x = rand() % (10*n);
+			assert(a->add(x) == s.insert(x).second);
+		}
+		for (size_t i = 0; i < n/4; i++) {
+			int x = rand() % (10*n);
+			assert(a->remove(x) == (s.erase(x) == 1));
+		}
+		assert(a->size() == (int)s.size());
+		for (size_t i = 0; i < 2*n; i++) {
+			int x = rand() % (10*n+2) - 1;
+			std::set<int>::iterator it = s.lower_bound(x);
+			assert(a->find(x) == (it == s.end() ? 0 : *it));
+		}
+		delete a;
+	}
+	for (size_t b = 1; b <= 1000; b *= 7) {
+		// with an insert buffer, flushed both ways
+		StlSet<int> s;
+		todolist::TodoList4<int> tdl4;
+		tdl4.setBufferSize(b);
+		srand(1);
+		for (size_t i = 0; i < n; i++) {
+			int x = rand() % (5*n);
+			assert(tdl4.add(x) == s.add(x));
+		}
+		assert(tdl4.size() == s.size());
+		// values already in the lists aren't added again
+		tdl4.flush();
+		for (int x = 0; x < (int)(5*n); x += 7)
+			assert(tdl4.add(x) == s.add(x));
+		assert(tdl4.size() == s.size());
+		test_search(s, tdl4, n);
+	}
+	{
+		StlSet<int> s;
+		todolist::LogStructuredArray<int> lsa;
+		test_dicts(s, lsa, n);
+	}
+	{
+		todolist::LogStructuredArray<int> lsa2(true);
+		todolist::LogStructuredArray<int> lsa3(true, true);
+		test_dicts(lsa2, lsa3, n);
 	}
 	{
 		srand(1);
@@ -309,15 +1098,190 @@ void sanity_tests(size_t n) {
 		for (size_t i = 0; i < n; i++)
 			if (i == 0 || data[i] > data[i-1])
 				data[unique++] = data[i];
-		SortedArray<int> sa(data, unique);
+		todolist::SortedArray<int> sa(data, unique);
 		ods::BinarySearchTree1<int> bst(data, unique);
 		test_search(sa, bst, n);
+		test_search_batch(sa, bst, n, 1);
+		test_search_batch(sa, bst, n, 7);
+		test_search_batch(bst, sa, n, 7);
+		todolist::EytzingerArray<int> ea(data, unique);
+		test_search(sa, ea, n);
+		todolist::STree<int> st(data, unique);
+		test_search(sa, st, n);
 		delete[] data;
 	}
 
 }
 
 
+// Fill data with the first n values of gen_data, sort them, and remove
+// duplicates. Returns the number of distinct values, which are stored in
+// data[0],...,data[unique-1]
+size_t sorted_unique(Integer *data, size_t n,
+		int (*gen_data)(size_t, size_t)) {
+	srand(1);
+	for (size_t i = 0; i < n; i++)
+		data[i] = gen_data(i, n);
+	std::sort(data, data+n);
+	size_t unique = 0;
+	for (size_t i = 0; i < n; i++)
+		if (i == 0 || data[i] > data[i-1])
+			data[unique++] = data[i];
+	return unique;
+}
+
+// Compare a TodoList4 built with buildFrom() and one built with
+// buildWeighted() on searches*n queries whose ranks follow a Zipf law with
+// exponent s.  The ranks are given to the keys in random order.  The
+// weights come from another day's worth of queries, as from a query log.
+void zipf_search(size_t n, int (*gen_data)(size_t, size_t), double s,
+		double epsilon) {
+	static int summer;
+	Integer *data = new Integer[n];
+	size_t m = sorted_unique(data, n, gen_data);
+	std::random_shuffle(data, data+m);
+	vector<double> cdf(m);
+	double total = 0;
+	for (size_t r = 0; r < m; r++)
+		cdf[r] = total += pow(r+1, -s);
+	vector<Integer> queries(searches*n);
+	vector<double> weights(m);
+	for (size_t i = 0; i < 2*searches*n; i++) {
+		double u = total * rand() / (RAND_MAX + 1.0);
+		size_t r = std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+		r = min(r, m-1);
+		if (i < searches*n)
+			weights[r]++;
+		else
+			queries[i - searches*n] = data[r];
+	}
+	vector<std::pair<Integer,double> > kw(m);
+	for (size_t r = 0; r < m; r++)
+		kw[r] = std::make_pair(data[r], weights[r]);
+
+	for (int k = 0; k < 2; k++) {
+		todolist::TodoList4<Integer> tdl4(epsilon);
+		const char *name = (k == 0) ? "TodoList4(zipf)" : "TodoList4(biased,zipf)";
+		if (k == 0)
+			tdl4.buildFrom(data, data+m);
+		else
+			tdl4.buildWeighted(kw.begin(), kw.end());
+		Integer::resetComparisons();
+		long sum = 0;
+		auto start = std::chrono::high_resolution_clock::now();
+		for (size_t i = 0; i < queries.size(); i++)
+			sum += (int)tdl4.find(queries[i]);
+		auto stop = std::chrono::high_resolution_clock::now();
+
+		std::chrono::duration<double> elapsed = stop - start;
+		double avg = ((double)Integer::getComparisons()) / queries.size();
+		double c = avg * log(2) / log(tdl4.size());
+		cout << name << " FIND " << n << " " << elapsed.count()
+				<< " " << Integer::getComparisons() << " " << c << endl;
+		summer += sum; // to make sure this isn't optimized away
+	}
+	delete[] data;
+}
+
+
+// The TodoList4 options given on the command line
+struct Tdl4Options {
+	double space_factor;
+	bool compact, learned, hashed, append, frozen;
+	size_t buffer, batch;
+	int bulk;
+};
+
+template<class Dict>
+void todolist4_run(Dict &tdl4, const Tdl4Options &o, size_t n,
+		int (*gen_data)(size_t, size_t), int (*gen_search)(size_t, size_t)) {
+	if (o.space_factor > 0)
+		tdl4.setSpaceFactor(o.space_factor);
+	tdl4.setIncrementalCompaction(o.compact);
+	tdl4.setLearned(o.learned);
+	tdl4.setHashIndex(o.hashed);
+	tdl4.setBufferSize(o.buffer);
+	tdl4.setAppend(o.append);
+	const char *name = o.learned ? "TodoList4(learned)" : "TodoList4";
+	if (o.bulk > 0)
+		bulk_build(tdl4, name, n, gen_data, o.bulk);
+	else
+		build(tdl4, name, n, gen_data);
+	if (o.frozen)
+		freeze_thaw(tdl4, name, n, true);
+	if (o.batch > 0)
+		search_batch(tdl4, name, n, gen_search, o.batch);
+	else
+		search(tdl4, name, n, gen_search);
+	if (o.frozen) {
+		tdl4.printStats(cout);
+		freeze_thaw(tdl4, name, n, false);
+	}
+	if (o.hashed)
+		membership(tdl4, name, n, gen_search);
+	tdl4.printStats(cout);
+}
+
+// Test the TodoListBase with the given policies
+template<class Layout, class Rebuild, class Alloc>
+void tdl_run(const string &name, double epsilon, size_t n,
+		int (*gen_data)(size_t, size_t), int (*gen_search)(size_t, size_t)) {
+	todolist::TodoListBase<Integer, Layout, Rebuild, Alloc> tdl(epsilon);
+	build_and_search(tdl, name.c_str(), n, gen_data, gen_search);
+}
+
+// Choose the policies named in spec = "<layout>,<rebuild>,<alloc>" one at
+// a time. Returns false if one of the names is unknown
+template<class Layout, class Rebuild>
+bool tdl_alloc(const string &spec, const string &alloc, double epsilon,
+		size_t n, int (*gen_data)(size_t, size_t),
+		int (*gen_search)(size_t, size_t)) {
+	string name = "TodoList(" + spec + ")";
+	if (alloc == "full")
+		tdl_run<Layout, Rebuild, todolist::FullHeightAlloc>(name, epsilon, n,
+				gen_data, gen_search);
+	else if (alloc == "sizeclass")
+		tdl_run<Layout, Rebuild, todolist::SizeClassAlloc>(name, epsilon, n,
+				gen_data, gen_search);
+	else
+		return false;
+	return true;
+}
+
+template<class Layout>
+bool tdl_rebuild(const string &spec, const string &rebuild,
+		const string &alloc, double epsilon, size_t n,
+		int (*gen_data)(size_t, size_t), int (*gen_search)(size_t, size_t)) {
+	if (rebuild == "halving")
+		return tdl_alloc<Layout, todolist::HalvingRebuild>(spec, alloc,
+				epsilon, n, gen_data, gen_search);
+	else if (rebuild == "counting")
+		return tdl_alloc<Layout, todolist::CountingRebuild>(spec, alloc,
+				epsilon, n, gen_data, gen_search);
+	return false;
+}
+
+bool tdl_layout(const string &spec, double epsilon, size_t n,
+		int (*gen_data)(size_t, size_t), int (*gen_search)(size_t, size_t)) {
+	size_t c1 = spec.find(','), c2 = spec.find(',', c1+1);
+	if (c1 == string::npos || c2 == string::npos)
+		return false;
+	string layout = spec.substr(0, c1);
+	string rebuild = spec.substr(c1+1, c2-c1-1);
+	string alloc = spec.substr(c2+1);
+	if (layout == "plain")
+		return tdl_rebuild<todolist::PlainLayout>(spec, rebuild, alloc,
+				epsilon, n, gen_data, gen_search);
+	else if (layout == "nx")
+		return tdl_rebuild<todolist::NXLayout>(spec, rebuild, alloc,
+				epsilon, n, gen_data, gen_search);
+	else if (layout == "prefetch")
+		return tdl_rebuild<todolist::PrefetchNXLayout>(spec, rebuild, alloc,
+				epsilon, n, gen_data, gen_search);
+	return false;
+}
+
+
 void usage_error(const char *name) {
 	cerr << "Usage: " << name << " <args>+" << endl
 		<< "Possible values of <args> are:" << endl
@@ -325,12 +1289,34 @@ void usage_error(const char *name) {
 		<< " -eps=<eps>  : Set the value of epsilon for todolists and"
 					  << " scapegoat trees" << endl
 		<< " -sanity     : runs sanity tests to ensure correctness" << endl
+		<< " -maxrss     : report the peak memory usage before exiting" << endl
+		<< " -space=<f>  : let TodoList4 use f NX slots per key before it"
+		<< " rebuilds" << endl
+		<< " -bulk=<t>   : build TodoList4 in one go using t threads" << endl
+		<< " -learned    : make TodoList4 start searches with a learned model"
+		<< endl
+		<< " -buffer=<b> : give TodoList4 an insert buffer of b values" << endl
+		<< " -noappend   : turn off TodoList4's fast path for adding a new maximum"
+		<< endl
+		<< " -hash       : give TodoList4 a hash index and time contains()"
+		<< endl
+		<< " -refs32     : give TodoList4 32-bit next pointers" << endl
+		<< " -freeze     : freeze TodoList4 for its searches, and time freezing"
+		<< " and thawing" << endl
+		<< " -compact    : make TodoList4 shrink oversized nodes a few at a time"
+		<< endl << "               instead of rebuilding" << endl
+		<< " -batch=<g>  : do searches in batches with g in flight at once"
+		<< " (for structures that support it)" << endl
+		<< " -searches=<k> : do k*n searches (default is 5*n)" << endl
 		<< " -sequential : use sequential insertions (default is random)"
 		<< endl
 		<< " -requential : use reverse sequential insertions (default is random)"
 		<< endl
 		<< " -shuffled   : use shuffled insertions (sqrt(n) groups)" << endl
+		<< " -skewed     : use skewed insertions and searches" << endl
 		<< " -bst        : test static balanced binary search tree" << endl
+		<< " -eytzinger  : test static sorted array in Eytzinger order" << endl
+		<< " -stree      : test static B-tree with 16 keys per node" << endl
 		<< " -stlset     : test STL set implementation" << endl
 		<< " -redblack   : test red-black tree (Guibas and Sedgewick)" << endl
 		<< " -treap      : test treap (Aragon and Seidel, Vuillemin)" << endl
@@ -341,7 +1327,28 @@ void usage_error(const char *name) {
 		<< " -todolist2  : test todolist (version 2)" << endl
 		<< " -todolist3  : test todolist (version 3)" << endl
 		<< " -todolist4  : test todolist (version 4)" << endl
-		<< " -linkedtodolist : test linked todolist" << endl << endl
+		<< " -pq         : use STLSet, Skiplist and TodoList4 as priority queues"
+		<< endl
+		<< " -zipf[=<s>] : test TodoList4 built balanced and built biased on"
+		<< " Zipf-distributed" << endl
+		<< "               searches with exponent s (default 1)" << endl
+		<< " -external   : test todolist with its bottom level in a file"
+		<< endl
+		<< " -linkedtodolist : test linked todolist" << endl
+		<< " -strings    : test STL set and todolist (versions 2-4) with URL-like"
+		<< " string keys," << endl
+		<< "               with and without cached key prefixes" << endl
+		<< " -tdl=<layout>,<rebuild>,<alloc> : test todolist with these"
+		<< " policies," << endl
+		<< "               <layout> is plain, nx or prefetch," << endl
+		<< "               <rebuild> is halving or counting," << endl
+		<< "               <alloc> is full or sizeclass" << endl
+		<< " -logarray   : test log-structured sorted arrays (Bentley and Saxe)"
+		<< endl
+		<< " -logarray2  : test log-structured sorted arrays with Eytzinger runs"
+		<< endl
+		<< " -logarray3  : test logarray2 with background compaction" << endl
+		<< endl
 		<< "Consult README for a discussion of different todolist versions."
 		<< endl << endl
 		<< "Example: " << name << " -1000000 -todolist4 -redblack" << endl
@@ -359,6 +1366,17 @@ int main(int argc, char **argv) {
 	int (*gen_data)(size_t, size_t) = rand_data;
 	int (*gen_search)(size_t, size_t) = rand_search;
 	double epsilon = .2;
+	size_t batch = 0;
+	double space_factor = 0;
+	bool learned = false;
+	bool hashed = false;
+	bool refs32 = false;
+	bool append = true;
+	bool frozen = false;
+	size_t buffer = 0;
+	int bulk = 0;
+	bool compact = false;
+	bool maxrss = false;
 	for (int i = 1; i < argc; i++) {
 		if (strlen(argv[i]) > 0 && argv[i][0] == '-' && isdigit(argv[i][1])) {
 			n = atoi(argv[i]+1);
@@ -370,6 +1388,44 @@ int main(int argc, char **argv) {
 			int delay = atoi(argv[i] + 7);
 			Integer::setDelay(delay);
 			cout << "I: comparison delay set to " << delay << endl;
+		} else if (strncmp(argv[i], "-batch=", 7) == 0) {
+			batch = atoi(argv[i] + 7);
+			cout << "I: batched searches with " << batch << " in flight" << endl;
+		} else if (strncmp(argv[i], "-searches=", 10) == 0) {
+			searches = atoi(argv[i] + 10);
+			cout << "I: doing " << searches << "n searches" << endl;
+		} else if (strncmp(argv[i], "-space=", 7) == 0) {
+			space_factor = strtod(argv[i] + 7, NULL);
+			cout << "I: space factor = " << space_factor << " for TodoList4"
+					<< endl;
+		} else if (strncmp(argv[i], "-bulk=", 6) == 0) {
+			bulk = atoi(argv[i] + 6);
+			cout << "I: TodoList4 is built with buildFrom() using " << bulk
+					<< " threads" << endl;
+		} else if (strcmp(argv[i], "-learned") == 0) {
+			cout << "I: TodoList4 uses a learned model for its middle list"
+					<< endl;
+			learned = true;
+		} else if (strncmp(argv[i], "-buffer=", 8) == 0) {
+			buffer = atoi(argv[i] + 8);
+			cout << "I: TodoList4 buffers " << buffer << " adds at a time" << endl;
+		} else if (strcmp(argv[i], "-noappend") == 0) {
+			cout << "I: TodoList4 searches for the place of every add" << endl;
+			append = false;
+		} else if (strcmp(argv[i], "-freeze") == 0) {
+			cout << "I: TodoList4 is frozen for searches" << endl;
+			frozen = true;
+		} else if (strcmp(argv[i], "-hash") == 0) {
+			cout << "I: TodoList4 keeps a hash index for contains()" << endl;
+			hashed = true;
+		} else if (strcmp(argv[i], "-refs32") == 0) {
+			cout << "I: TodoList4 uses 32-bit next pointers" << endl;
+			refs32 = true;
+		} else if (strcmp(argv[i], "-compact") == 0) {
+			cout << "I: TodoList4 compacts nodes incrementally" << endl;
+			compact = true;
+		} else if (strcmp(argv[i], "-maxrss") == 0) {
+			maxrss = true;
 		} else if (strcmp(argv[i], "-sanity") == 0) {
 			cout << "I: Doing sanity tests...";
 			cout.flush();
@@ -381,39 +1437,57 @@ int main(int argc, char **argv) {
 		} else if (strcmp(argv[i], "-requential") == 0) {
 			cout << "I: Using reversed sequential data" << endl;
 			gen_data = requential_data;
+		} else if (strcmp(argv[i], "-skewed") == 0) {
+			cout << "I: Using skewed data" << endl;
+			gen_data = skewed_data;
+			gen_search = skewed_search;
 		} else if (strcmp(argv[i], "-shuffled") == 0) {
 			cout << "I: Using shuffled data" << endl;
 			gen_data = requential_data;
 		} else if (strcmp(argv[i], "-bst") == 0) {
 			Integer *data = new Integer[n];
-			srand(1);
-			for (size_t i = 0; i < n; i++)
-				data[i] = gen_data(i, n);
-			std::sort(data, data+n);
-			size_t unique = 0;
-			for (size_t i = 0; i < n; i++)
-				if (i == 0 || data[i] > data[i-1])
-					data[unique++] = data[i];
-			SortedArray<Integer> sa(data, unique);
-			search(sa, "SortedArray", n, gen_search);
+			size_t unique = sorted_unique(data, n, gen_data);
+			todolist::SortedArray<Integer> sa(data, unique);
+			if (batch > 0)
+				search_batch(sa, "SortedArray", n, gen_search, batch);
+			else
+				search(sa, "SortedArray", n, gen_search);
 			ods::BinarySearchTree1<Integer> bst(data, unique);
 			delete[] data;
-			search(bst, "BinarySearchTree", n, gen_search);
+			if (batch > 0)
+				search_batch(bst, "BinarySearchTree", n, gen_search, batch);
+			else
+				search(bst, "BinarySearchTree", n, gen_search);
+		} else if (strcmp(argv[i], "-eytzinger") == 0) {
+			Integer *data = new Integer[n];
+			size_t unique = sorted_unique(data, n, gen_data);
+			todolist::EytzingerArray<Integer> ea(data, unique);
+			delete[] data;
+			search(ea, "Eytzinger", n, gen_search);
+		} else if (strcmp(argv[i], "-stree") == 0) {
+			Integer *data = new Integer[n];
+			size_t unique = sorted_unique(data, n, gen_data);
+			todolist::STree<Integer> st(data, unique);
+			delete[] data;
+			search(st, "STree", n, gen_search);
 		} else if (strcmp(argv[i], "-stlset") == 0) {
 			StlSet<Integer> s;
 			build_and_search(s, "STLSet", n, gen_data, gen_search);
 		} else if (strcmp(argv[i], "-redblack") == 0) {
 			ods::RedBlackTree1<Integer> rbt;
-			build_and_search(rbt, "RedBlackTree", n, gen_data, gen_search);
+			build_and_search_batch(rbt, "RedBlackTree", n, gen_data, gen_search,
+					batch);
 		} else if (strcmp(argv[i], "-treap") == 0) {
 			ods::Treap1<Integer> t;
-			build_and_search(t, "Treap", n, gen_data, gen_search);
+			build_and_search_batch(t, "Treap", n, gen_data, gen_search, batch);
 		} else if (strcmp(argv[i], "-skiplist") == 0) {
 			ods::SkiplistSSet<Integer> sl;
-			build_and_search(sl, "Skiplist", n, gen_data, gen_search);
+			build_and_search_batch(sl, "Skiplist", n, gen_data, gen_search,
+					batch);
 		} else if (strcmp(argv[i], "-scapegoat") == 0) {
 			ods::ScapegoatTree1<Integer> st(1./(2.-epsilon));
-			build_and_search(st, "ScapegoatTree", n, gen_data, gen_search);
+			build_and_search_batch(st, "ScapegoatTree", n, gen_data, gen_search,
+					batch);
 		} else if (strcmp(argv[i], "-todolist") == 0) {
 				todolist::TodoList<Integer> tdl(epsilon);
 				build_and_search(tdl, "TodoList", n, gen_data, gen_search);
@@ -424,15 +1498,116 @@ int main(int argc, char **argv) {
 				todolist::TodoList3<Integer> tdl3(epsilon);
 				build_and_search(tdl3, "TodoList3", n, gen_data, gen_search);
 		} else if (strcmp(argv[i], "-todolist4") == 0) {
+			Tdl4Options o = { space_factor, compact, learned, hashed, append,
+					frozen, buffer, batch, bulk };
+			if (hashed && refs32) {
+				todolist::TodoList4<Integer, todolist::KeyCache<Integer>,
+						todolist::HashIndexed, todolist::Untimed,
+						todolist::CompactRefs> tdl4(epsilon);
+				todolist4_run(tdl4, o, n, gen_data, gen_search);
+			} else if (hashed) {
+				todolist::TodoList4<Integer, todolist::KeyCache<Integer>,
+						todolist::HashIndexed> tdl4(epsilon);
+				todolist4_run(tdl4, o, n, gen_data, gen_search);
+			} else if (refs32) {
+				todolist::TodoList4<Integer, todolist::KeyCache<Integer>,
+						todolist::NoIndex, todolist::Untimed,
+						todolist::CompactRefs> tdl4(epsilon);
+				todolist4_run(tdl4, o, n, gen_data, gen_search);
+			} else {
 				todolist::TodoList4<Integer> tdl4(epsilon);
-				build_and_search(tdl4, "TodoList4", n, gen_data, gen_search);
+				todolist4_run(tdl4, o, n, gen_data, gen_search);
+			}
+		} else if (strcmp(argv[i], "-zipf") == 0
+				|| strncmp(argv[i], "-zipf=", 6) == 0) {
+			double s = (argv[i][5] == '=') ? strtod(argv[i] + 6, NULL) : 1;
+			zipf_search(n, gen_data, s, epsilon);
+		} else if (strncmp(argv[i], "-tdl=", 5) == 0) {
+			if (!tdl_layout(argv[i]+5, epsilon, n, gen_data, gen_search))
+				usage_error(argv[0]);
+		} else if (strcmp(argv[i], "-strings") == 0) {
+			{
+				StlSet<string> s;
+				build_and_search_strings(s, "STLSet(string)", n);
+			}
+			{
+				todolist::TodoList4<string, todolist::NoKeyCache<string> >
+						tdl4(epsilon);
+				build_and_search_strings(tdl4, "TodoList4(string,nocache)", n);
+			}
+			{
+				todolist::TodoList4<string> tdl4(epsilon);
+				build_and_search_strings(tdl4, "TodoList4(string)", n);
+			}
+			{
+				todolist::TodoList2<string> tdl2(epsilon);
+				build_and_search_strings(tdl2, "TodoList2(string)", n);
+			}
+			{
+				todolist::TodoList3<string> tdl3(epsilon);
+				build_and_search_strings(tdl3, "TodoList3(string)", n);
+			}
+		} else if (strcmp(argv[i], "-external") == 0) {
+			const char *path = "todolist-external.dat";
+			try {
+				todolist::ExternalTodoList<Integer> etdl(path,
+						max(n/16, (size_t)4096));
+				build(etdl, "ExternalTodoList", n, gen_data);
+				etdl.merge();
+				etdl.evict();
+				struct rusage before, after;
+				getrusage(RUSAGE_SELF, &before);
+				search(etdl, "ExternalTodoList", n, gen_search);
+				getrusage(RUSAGE_SELF, &after);
+				etdl.printStats(cout);
+				cout << "I: "
+						<< (double)(after.ru_majflt - before.ru_majflt) / (searches*n)
+						<< " major and "
+						<< (double)(after.ru_minflt - before.ru_minflt) / (searches*n)
+						<< " minor page faults per query" << endl;
+			} catch (std::exception &e) {
+				cerr << "ExternalTodoList: " << e.what() << endl;
+			}
+			// remove the file even if a merge failed
+			unlink(path);
+			unlink((string(path) + ".merge").c_str());
+		} else if (strcmp(argv[i], "-pq") == 0) {
+			{
+				StlSet<Integer> s;
+				push_pop(s, "STLSet", n);
+			}
+			{
+				ods::SkiplistSSet<Integer> sl;
+				push_pop(sl, "Skiplist", n);
+			}
+			{
+				todolist::TodoList4<Integer> tdl4(epsilon);
+				push_pop(tdl4, "TodoList4", n);
+			}
 		} else if (strcmp(argv[i], "-linkedtodolist") == 0) {
 			todolist::LinkedTodoList<Integer> ltdl(epsilon);
 			build_and_search(ltdl, "LinkedTodoList", n, rand_data, rand_search);
+		} else if (strcmp(argv[i], "-logarray") == 0) {
+			todolist::LogStructuredArray<Integer> lsa;
+			build_and_search(lsa, "LogStructuredArray", n, gen_data, gen_search);
+		} else if (strcmp(argv[i], "-logarray2") == 0) {
+			todolist::LogStructuredArray<Integer> lsa2(true);
+			build_and_search(lsa2, "LogStructuredArray2", n, gen_data,
+					gen_search);
+		} else if (strcmp(argv[i], "-logarray3") == 0) {
+			todolist::LogStructuredArray<Integer> lsa3(true, true);
+			build_and_search(lsa3, "LogStructuredArray3", n, gen_data,
+					gen_search);
 		} else {
 			usage_error(argv[0]);
 		}
 	}
+	if (maxrss) {
+		struct rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		cout << "I: maximum resident set size = " << usage.ru_maxrss << "kB"
+				<< endl;
+	}
 	return 0;
 }
 
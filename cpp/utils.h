@@ -8,8 +8,28 @@
 #ifndef UTILS_H_
 #define UTILS_H_
 
+#include <limits>
+
 namespace ods {
 
+/**
+ * Infinity<T>::value() is a T that no T is less than, if exists is true.
+ * Lists can end with a sentinel holding it, so that searches don't have
+ * to check for the end of the list.  Arithmetic types have one, and other
+ * types can specialize this.
+ */
+template<class T, bool = std::numeric_limits<T>::is_specialized>
+struct Infinity {
+	static const bool exists = false;
+	static T value() { return T(); }
+};
+
+template<class T>
+struct Infinity<T, true> {
+	static const bool exists = true;
+	static T value() { return std::numeric_limits<T>::max(); }
+};
+
 template<class T> inline
 T min(T a, T b) {
 	return ((a)<(b) ? (a) : (b));
@@ -1,16 +1,25 @@
 #!/usr/bin/python
 
 from __future__ import division
+import os
+import sys
 
 structs={"todolist-0.2", "todolist-0.35", "skiplist", "redblack", "stlset",
-         "treap", "scapegoat", "bst", "sortedarray"}
+         "treap", "scapegoat", "bst", "sortedarray", "eytzinger", "stree"}
+
+# find times are normalized by those of a static structure, by default the
+# balanced binary search tree; use e.g. ./normalize.py eytzinger to change it
+baseline = sys.argv[1] if len(sys.argv) > 1 else 'bst'
 
 ns = range(25000, 2000001, 25000)
-print 'Reading bst-find.dat'
-data = [s.split() for s in open('bst-find.dat').read().splitlines()]
+print 'Reading {}-find.dat'.format(baseline)
+data = [s.split() for s in open('{}-find.dat'.format(baseline)).read().splitlines()]
 denominators = dict([ (x[2], x[3]) for x in data])
 for s in structs:
     infile = '{}-find.dat'.format(s)
+    if not os.path.exists(infile):
+        print "Skipping {}, no data".format(infile)
+        continue
     outfile = '{}-find-norm.dat'.format(s)
     data = [s.split() for s in open(infile).read().splitlines()]
     print "Normalizing {} saving to {}".format(infile, outfile)
@@ -19,12 +28,15 @@ for s in structs:
         denom = denominators[d[2]]
         of.write("{} {}\n".format(d[2], float(d[3])/float(denom)))
         
-structs.remove('bst')
-structs.remove('sortedarray')
+for s in ['bst', 'sortedarray', 'eytzinger', 'stree']:
+    structs.remove(s)
 data = [s.split() for s in open('redblack-add.dat').read().splitlines()]
 denominators = dict([ (x[2], x[3]) for x in data])
 for s in structs:
     infile = '{}-add.dat'.format(s)
+    if not os.path.exists(infile):
+        print "Skipping {}, no data".format(infile)
+        continue
     outfile = '{}-add-norm.dat'.format(s)
     data = [s.split() for s in open(infile).read().splitlines()]
     print "Normalizing {} saving to {}".format(infile, outfile)
@@ -4,8 +4,10 @@
 ns="25000 50000 75000 100000 125000 150000 175000 200000 225000 250000 275000 300000 325000 350000 375000 400000 425000 450000 475000 500000 525000 550000 575000 600000 625000 650000 675000 700000 725000 750000 775000 800000 825000 850000 875000 900000 925000 950000 975000 1000000 1025000 1050000 1075000 1100000 1125000 1150000 1175000 1200000 1225000 1250000 1275000 1300000 1325000 1350000 1375000 1400000 1425000 1450000 1475000 1500000 1525000 1550000 1575000 1600000 1625000 1650000 1675000 1700000 1725000 1750000 1775000 1800000 1825000 1850000 1875000 1900000 1925000 1950000 1975000 2000000"
 
 for n in $ns; do
-    ./main -$n -bst > tmp.dat
+    ./main -$n -bst -eytzinger -stree > tmp.dat
     grep 'SortedArray' tmp.dat >> sortedarray-find.dat
     grep 'BinarySearchTree' tmp.dat >> bst-find.dat
+    grep 'Eytzinger' tmp.dat >> eytzinger-find.dat
+    grep 'STree' tmp.dat >> stree-find.dat
 done
 